@@ -6,25 +6,694 @@
 #include <ctime>        // For date and time functions (used in logging with timestamps)
 #include <limits>       // For input validation (e.g. clearing cin buffer with numeric_limits)
 #include <map>         // For using map to count categories
+#include <unordered_map> // For the productID and name lookup indexes
+#include <set>          // For the quantity-ordered low stock index
+#include <sstream>      // For building and splitting journal records
+#include <cstdio>       // For FILE* based journal appends (fopen, fputs, fflush)
+#include <cstdint>      // For fixed-width fields in the binary snapshot
+#include <cstring>      // For memcpy/memcmp on snapshot headers
+#include <atomic>       // For the lock-free history log queue
+#include <thread>       // For the background history logger
+#include <mutex>        // For waking/stopping the history logger
+#include <shared_mutex> // For the store lock shared by concurrent tills
+#include <condition_variable> // For the logger flush interval and flush requests
+#include <chrono>       // For the logger flush interval
+#include <cmath>        // For llround when converting old floating point prices
+#include <charconv>     // For to_chars when rendering table rows
+#include <random>       // For the --bench synthetic catalog and workload
+#include <functional>   // For the tasks handed to runParallel()
+#include <memory>       // For the fixed-size item blocks of ItemStore
+#ifdef _WIN32
+    #include <io.h>     // For _commit (flush journal to disk on Windows)
+    #include <windows.h> // For MoveFileExA (atomic snapshot replace)
+    #include <direct.h>  // For _mkdir/_chdir (--bench working directory)
+#else
+    #include <unistd.h> // For fsync (flush journal to disk on Mac/Linux)
+    #include <fcntl.h>  // For open() on the snapshot file
+    #include <sys/mman.h> // For mmap of the binary snapshot
+    #include <sys/stat.h> // For fstat (snapshot size)
+#endif
+#ifdef __linux__
+    #include <sys/socket.h> // For the --server listening socket
+    #include <sys/epoll.h>  // For the --server event loop
+    #include <netinet/in.h> // For sockaddr_in
+    #include <csignal>      // For stopping the server on SIGINT/SIGTERM
+    #include <cerrno>       // For EAGAIN/EINTR on non-blocking sockets
+#endif
 using namespace std;
 
+// Money is a whole number of cents: sums are exact however many sales are added
+// up, and formatting is plain integer arithmetic
+typedef int64_t Money;
+
+// Item name. Names entered or imported own their text. With --lazy-load the
+// names read from stock.bin point into the mapped file instead, so loading
+// copies no strings and a name is only read from disk the first time it is
+// used. The text is never changed in place; assigning a name replaces it.
+class ItemName {
+public:
+    ItemName() = default;
+    ItemName(const string& text) : owned(text) {}
+    ItemName(const char* text) : owned(text) {}
+
+    // Refers to length bytes at text; the store keeps the mapping (see ItemStore::keepMapping)
+    static ItemName mapped(const char* text, uint32_t length) {
+        ItemName name;
+        name.view = text;
+        name.viewLength = length;
+        return name;
+    }
+
+    const char* data() const { return view ? view : owned.data(); }
+    size_t size() const { return view ? viewLength : owned.size(); }
+    bool empty() const { return size() == 0; }
+    operator string() const { return string(data(), size()); }
+
+    void assign(const char* text, size_t length) {
+        owned.assign(text, length);
+        view = nullptr;
+        viewLength = 0;
+    }
+
+    ItemName& operator=(const string& text) {
+        owned = text;
+        view = nullptr;
+        viewLength = 0;
+        return *this;
+    }
+
+private:
+    string owned;
+    const char* view = nullptr;   // Set for names still in the mapped snapshot
+    uint32_t viewLength = 0;
+};
+
+inline bool operator==(const ItemName& a, const ItemName& b) {
+    return a.size() == b.size() && memcmp(a.data(), b.data(), a.size()) == 0;
+}
+inline bool operator==(const ItemName& a, const string& b) {
+    return a.size() == b.size() && memcmp(a.data(), b.data(), a.size()) == 0;
+}
+inline bool operator!=(const ItemName& a, const string& b) { return !(a == b); }
+inline string operator+(const string& left, const ItemName& right) {
+    return string(left).append(right.data(), right.size());
+}
+inline string operator+(const char* left, const ItemName& right) {
+    return string(left).append(right.data(), right.size());
+}
+inline ostream& operator<<(ostream& out, const ItemName& name) {
+    return out.write(name.data(), (streamsize)name.size());
+}
+
 // Enhanced structure with better data management
 struct StockItem {
     int productID;
-    string name;
-    string category;
+    ItemName name;
+    uint16_t categoryID;   // Position in the categoryOptions dictionary
     int quantity;
-    double lastPrice;
+    Money lastPrice;
     time_t dateAdded;
     
-    StockItem() : productID(0), quantity(0), lastPrice(0.0), dateAdded(time(0)) {}
+    StockItem() : productID(0), categoryID(0), quantity(0), lastPrice(0), dateAdded(time(0)) {}
+};
+
+// Item storage: items live in fixed-size blocks that are never reallocated, so
+// adding items never moves existing ones. Positions stay dense (0..size()-1)
+// for scans and the columns, so a removal moves the last item into the gap:
+// removing any item can move another one, and a StockItem* or position is only
+// good until the next removal (or block copy, see below). Code that has to
+// hold on to an item keeps its product ID or a copy. Each item also gets an
+// integer handle that never changes while it exists; the lookup indexes store
+// handles, so nothing in them has to be fixed up when an item changes
+// position. Freed handles are reused for later inserts.
+//
+// Blocks are shared copy-on-write with StockSnapshots. Taking a snapshot starts
+// a new epoch and copies only the block pointers; the first write to a block
+// in a later epoch copies that block if a snapshot still holds it, so readers
+// of the snapshot see the items exactly as they were and never lock anything.
+typedef uint32_t ItemHandle;
+const size_t ITEM_BLOCK_SHIFT = 12;                 // 4096 items per block
+const size_t ITEM_BLOCK_SIZE = (size_t)1 << ITEM_BLOCK_SHIFT;
+
+struct ItemBlock {
+    StockItem items[ITEM_BLOCK_SIZE];
+};
+
+// Point-in-time view of stock, produced by ItemStore::snapshot(). Positions are
+// the live positions at the time it was taken.
+class StockSnapshot {
+public:
+    StockSnapshot() = default;
+    StockSnapshot(StockSnapshot&&) = default;
+    StockSnapshot& operator=(const StockSnapshot&) = delete;
+    // The blocks are let go under the store's detach lock, so a till that then
+    // finds a block unshared also sees every read made through this view
+    ~StockSnapshot() {
+        if (!releaseMutex) return;
+        lock_guard<mutex> lock(*releaseMutex);
+        blocks.clear();
+    }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const StockItem& operator[](size_t position) const {
+        return blocks[position >> ITEM_BLOCK_SHIFT]->items[position & (ITEM_BLOCK_SIZE - 1)];
+    }
+    // Like categoryName(), against the dictionary as it was
+    const string& category(uint16_t id) const {
+        static const string unknown = "Other";
+        return id < categories.size() ? categories[id] : unknown;
+    }
+
+    Money revenue = 0;          // Total revenue at the same moment
+    vector<string> categories;  // categoryOptions at the same moment
+
+private:
+    friend class ItemStore;
+    vector<shared_ptr<const ItemBlock>> blocks;
+    vector<shared_ptr<const void>> mappings; // Files the names in blocks may point into
+    size_t count = 0;
+    mutex* releaseMutex = nullptr;
+};
+
+class ItemStore {
+public:
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    // Tills share the store while selling, so the block of an item may be copied
+    // by a write to one of its neighbours; reads go through the current pointer
+    const StockItem& operator[](size_t position) const {
+        const BlockSlot& slot = slots[position >> ITEM_BLOCK_SHIFT];
+        return slot.block.load(memory_order_acquire)->items[position & (ITEM_BLOCK_SIZE - 1)];
+    }
+
+    // Writable access: copies the block first if a snapshot taken since its last
+    // write still holds it. Named rather than a non-const operator[], so that
+    // plain reads of stock[i] never copy a block.
+    StockItem& edit(size_t position) {
+        size_t b = position >> ITEM_BLOCK_SHIFT;
+        if (slots[b].epoch.load(memory_order_acquire) != epoch) detachBlock(b);
+        return slots[b].block.load(memory_order_acquire)->items[position & (ITEM_BLOCK_SIZE - 1)];
+    }
+
+    ItemHandle handleAt(size_t position) const { return positionHandles[position]; }
+    size_t positionOf(ItemHandle handle) const { return handlePositions[handle]; }
+
+    // Appends a copy of item and returns its handle
+    ItemHandle push_back(const StockItem& item) {
+        reserve(count + 1);
+        edit(count) = item;
+        ItemHandle handle;
+        if (!freeHandles.empty()) {
+            handle = freeHandles.back();
+            freeHandles.pop_back();
+            handlePositions[handle] = (uint32_t)count;
+        } else {
+            handle = (ItemHandle)handlePositions.size();
+            handlePositions.push_back((uint32_t)count);
+        }
+        positionHandles.push_back(handle);
+        ++count;
+        return handle;
+    }
+
+    // Removes the item at position; the last item (if another) takes its place
+    void removeAt(size_t position) {
+        size_t last = count - 1;
+        freeHandles.push_back(positionHandles[position]);
+        if (position != last) {
+            edit(position) = std::move(edit(last));
+            positionHandles[position] = positionHandles[last];
+            handlePositions[positionHandles[position]] = (uint32_t)position;
+        }
+        edit(last) = StockItem(); // Releases the name
+        positionHandles.pop_back();
+        --count;
+    }
+
+    // Grows to n default items (handles equal to positions when the store was empty)
+    void resize(size_t n) {
+        while (count > n) removeAt(count - 1);
+        reserve(n);
+        while (count < n) push_back(StockItem());
+    }
+
+    // Allocates blocks for n items up front
+    void reserve(size_t n) {
+        size_t needed = (n + ITEM_BLOCK_SIZE - 1) >> ITEM_BLOCK_SHIFT;
+        if (needed <= owners.size()) return;
+        if (needed > slotCapacity) {
+            // Slots hold atomics, so a larger table is built and the pointers carried over
+            size_t capacity = max(needed, slotCapacity * 2);
+            unique_ptr<BlockSlot[]> grown(new BlockSlot[capacity]);
+            for (size_t b = 0; b < owners.size(); ++b) {
+                grown[b].block.store(slots[b].block.load(), memory_order_relaxed);
+                grown[b].epoch.store(slots[b].epoch.load(), memory_order_relaxed);
+            }
+            slots = std::move(grown);
+            slotCapacity = capacity;
+        }
+        while (owners.size() < needed) {
+            owners.push_back(make_shared<ItemBlock>());
+            slots[owners.size() - 1].block.store(owners.back().get(), memory_order_release);
+            slots[owners.size() - 1].epoch.store(epoch, memory_order_release);
+        }
+    }
+
+    // Keeps a mapped snapshot file alive while names point into it (--lazy-load).
+    // clear() lets it go; it is unmapped once no StockSnapshot holds it either.
+    void keepMapping(shared_ptr<const void> mapping) {
+        mappings.push_back(std::move(mapping));
+    }
+
+    void clear() {
+        owners.clear();
+        mappings.clear();
+        handlePositions.clear();
+        positionHandles.clear();
+        freeHandles.clear();
+        count = 0;
+    }
+
+    // Shares every block with the returned view. Writers must be excluded while
+    // this runs (storeMutex held exclusively, or no tills running); afterwards
+    // they carry on and only the blocks they touch are copied.
+    StockSnapshot snapshot() {
+        StockSnapshot view;
+        view.blocks.assign(owners.begin(), owners.end());
+        view.mappings = mappings;
+        view.count = count;
+        view.releaseMutex = &detachMutex;
+        epoch++;
+        return view;
+    }
+
+private:
+    struct BlockSlot {
+        atomic<ItemBlock*> block{nullptr};
+        atomic<uint64_t> epoch{0};   // Epoch of the last write; older means a snapshot may share it
+    };
+
+    // Gives block b to the current epoch, copying it if a snapshot still holds it
+    void detachBlock(size_t b) {
+        lock_guard<mutex> lock(detachMutex);
+        if (slots[b].epoch.load(memory_order_relaxed) == epoch) return; // Another till got here first
+        if (owners[b].use_count() > 1) {
+            shared_ptr<ItemBlock> copy = make_shared<ItemBlock>(*owners[b]);
+            owners[b] = copy;
+            slots[b].block.store(copy.get(), memory_order_release);
+        }
+        slots[b].epoch.store(epoch, memory_order_release);
+    }
+
+    vector<shared_ptr<ItemBlock>> owners;   // Replaced only by detachBlock or with writers excluded
+    vector<shared_ptr<const void>> mappings; // See keepMapping()
+    unique_ptr<BlockSlot[]> slots;          // Current block pointers, read without locks
+    size_t slotCapacity = 0;
+    size_t count = 0;
+    uint64_t epoch = 1;                     // Only changed by snapshot(), with writers excluded
+    mutex detachMutex;
+    vector<uint32_t> handlePositions; // Handle -> position (stale for free handles)
+    vector<ItemHandle> positionHandles; // Position -> handle
+    vector<ItemHandle> freeHandles;
+};
+
+// Binary snapshot (stock.bin): header, fixed-width records, then a string pool
+// holding names and categories. The file is mmap'ed on load and read in place.
+// Since version 2 the header also carries the revenue and journal sequence, so
+// stock and revenue are always checkpointed together in one file. Version 3
+// stores prices and revenue in cents instead of as doubles. Version 4 splits
+// the records into segments, each with its own string pool, listed in a table
+// after the header, so segments are written and parsed on separate threads.
+const char* SNAPSHOT_FILE = "stock.bin";
+const char* TEXT_STOCK_FILE = "stock.dat";
+const size_t EXPORT_FLUSH_BYTES = 1 << 20;    // Text and CSV exports are written in chunks of this size
+const char SNAPSHOT_MAGIC[8] = {'S', 'T', 'M', 'S', 'S', 'N', 'A', 'P'};
+const uint32_t SNAPSHOT_VERSION = 4;
+const size_t SNAPSHOT_V1_HEADER_SIZE = 24;    // Version 1 headers end after poolSize
+const size_t SNAPSHOT_SEGMENT_ITEMS = 65536;  // Items per segment (and per load task for older versions)
+const size_t PARALLEL_MIN_ITEMS = 50000;      // Smaller catalogs are loaded and indexed on one thread
+
+// --lazy-load: only the fixed-width fields are copied out of stock.bin. The file
+// stays mapped until the store is cleared or reloaded (a checkpoint renames a
+// new file over it, which leaves the mapping alone) and item names point into it.
+bool lazyLoad = false;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t itemCount;
+    uint64_t poolSize;        // Version 4: total of the segment pools
+    int64_t revenue;          // Version 2+: grand total at the checkpoint (cents; a double in version 2)
+    int64_t sequence;         // Version 2: last journal record contained in the snapshot
+};
+
+struct SnapshotRecord {
+    int32_t productID;
+    int32_t quantity;
+    int64_t lastPrice;        // Cents (a double before version 3)
+    int64_t dateAdded;
+    uint32_t nameOffset;      // Offsets are relative to the start of the string pool
+    uint32_t nameLength;
+    uint32_t categoryOffset;
+    uint32_t categoryLength;
+};
+
+// Version 4: the header is followed by a uint64 segment count and this table.
+// A segment is itemCount records followed by a pool their offsets refer to.
+struct SnapshotSegment {
+    uint64_t offset;          // From the start of the file
+    uint64_t itemCount;
+    uint64_t poolSize;
+};
+
+static_assert(sizeof(SnapshotHeader) == 40, "snapshot header layout changed");
+static_assert(sizeof(SnapshotRecord) == 40, "snapshot record layout changed");
+static_assert(sizeof(SnapshotSegment) == 24, "snapshot segment layout changed");
+
+// Kinds of logged actions (used for the history ring and the summary counters)
+enum ActionType { ACTION_OTHER, ACTION_SALE, ACTION_ADD, ACTION_RESTOCK, ACTION_UPDATE, ACTION_DELETE, ACTION_TYPE_COUNT };
+
+// Asynchronous history logger: logAction() pushes lines into a bounded lock-free
+// queue and a background thread appends them to history.log in large batches.
+const char* HISTORY_FILE = "history.log";
+const size_t LOG_QUEUE_CAPACITY = 4096;   // Must be a power of two
+
+struct LogSlot {
+    atomic<size_t> sequence;   // Slot turn counter (Vyukov bounded queue)
+    string line;
+};
+
+LogSlot logQueue[LOG_QUEUE_CAPACITY];
+atomic<size_t> logEnqueuePos(0);
+atomic<size_t> logDequeuePos(0);
+thread loggerThread;
+mutex loggerMutex;
+condition_variable loggerWake;        // Wakes the logger early (stop, flush request, full queue)
+condition_variable loggerFlushed;     // Signals flushLogger() callers
+atomic<bool> loggerRunning(false);
+long logFlushRequested = 0;           // Guarded by loggerMutex
+long logFlushCompleted = 0;           // Guarded by loggerMutex
+int logFlushIntervalMs = 250;         // How often buffered lines are written (--log-flush-ms)
+atomic<bool> logDrainRequested(false); // A producer found the queue full and is waiting for room
+
+// Structured history kept in memory: a fixed-size ring of the most recent actions,
+// used by viewStockHistory() so it never has to re-read history.log
+
+struct HistoryRecord {
+    time_t timestamp;
+    ActionType type;
+    int productID;
+    int quantity;
+    Money price;
+    char text[160];    // Logged message (truncated), stored inline so records never allocate
+};
+
+const size_t HISTORY_RING_CAPACITY = 256;
+const size_t HISTORY_RECENT_COUNT = 20;    // Entries shown by viewStockHistory()
+HistoryRecord historyRing[HISTORY_RING_CAPACITY];
+size_t historyRingNext = 0;                // Slot the next record goes into
+size_t historyRingCount = 0;               // Valid records (up to capacity)
+mutex historyRingMutex;
+
+// history.idx sits next to history.log and holds running per-type counters plus
+// the byte offsets of the last HISTORY_RECENT_COUNT lines, so neither the summary
+// nor the recent view ever scans the log from the start. The counters cover the
+// archived segments too.
+const char* HISTORY_INDEX_FILE = "history.idx";
+
+struct HistoryIndex {
+    uint64_t logSize;                          // Bytes of history.log covered by the index
+    uint64_t totalCount;
+    uint64_t typeCounts[ACTION_TYPE_COUNT];
+    uint64_t tailOffsets[HISTORY_RECENT_COUNT]; // Ring of line start offsets
+    size_t tailNext;
+    size_t tailCount;
+    uint64_t firstSegment;                     // Oldest archived segment still on disk
+    uint64_t nextSegment;                      // Number the next rotated segment gets
+    int64_t logStarted;                        // When the current history.log was started
+    uint64_t archivedBytes;                    // Disk space of the compressed segments
+};
+
+// Rotation: once history.log reaches historyRotateBytes, or has been written to
+// for HISTORY_ROTATE_SECONDS, it is renamed to history.<n>.log and a new one is
+// started. A background thread then compresses the segment into
+// history.<n>.log.lz4 (a standard LZ4 frame, so the lz4 tool can read it too)
+// and removes the plain copy. Only the newest HISTORY_KEEP_SEGMENTS are kept.
+uint64_t historyRotateBytes = 16 << 20;                // --log-rotate-mb (0: rotate by age only)
+const int64_t HISTORY_ROTATE_SECONDS = 7 * 24 * 3600;  // Weekly segments
+const uint64_t HISTORY_KEEP_SEGMENTS = 104;            // About two years of weekly segments
+const size_t LZ4_BLOCK_BYTES = 4 << 20;                // Frame block size (the 4 MB LZ4 maximum)
+thread historyCompressor;
+mutex historyCompressorMutex;      // Guards the two flags below
+bool historyCompressorRunning = false;
+bool historyCompressionPending = false; // A segment was rotated since the running round started
+
+HistoryIndex historyIndex = {};
+mutex historyIndexMutex;
+
+// Sales ledger: every sold line is appended to sales.ledger as a fixed-size
+// binary record, and hourly/daily totals per product and per category are
+// updated as the sale happens, so reports read O(buckets) totals instead of
+// parsing history.log. sales.rollup holds the totals plus the ledger size they
+// cover; ledger records beyond that (after a crash) are folded in at startup.
+// A sale is first queued in its product's stripe (see SalesStripe below); the
+// flusher merges the stripes into the ledger and the rollups.
+const char* SALES_LEDGER_FILE = "sales.ledger";
+const char* SALES_ROLLUP_FILE = "sales.rollup";
+const int SALES_HOURLY_RETENTION_DAYS = 35;   // Older hourly buckets are dropped; daily ones are kept
+
+struct SaleRecord {
+    int64_t timestamp;
+    int32_t productID;
+    int32_t quantity;
+    Money price;           // Per unit
+};
+
+struct SalesTotals {
+    int64_t lines;
+    int64_t units;
+    Money revenue;
+};
+
+struct SalesBucket {
+    SalesTotals total;
+    unordered_map<int, SalesTotals> products;      // productID -> totals
+    unordered_map<string, SalesTotals> categories; // Category at the time of the sale -> totals
+};
+
+enum RollupPeriod { ROLLUP_HOURLY, ROLLUP_DAILY, ROLLUP_PERIOD_COUNT };
+
+map<int64_t, SalesBucket> salesRollups[ROLLUP_PERIOD_COUNT]; // Bucket start time -> totals
+FILE* salesLedgerFile = nullptr;
+uint64_t salesLedgerSize = 0;   // Ledger bytes included in salesRollups
+bool salesLedgerFailing = false; // A ledger write failed and was reported; cleared by the next good flush
+mutex salesLedgerMutex;         // Guards the ledger file, the rollups and the merge of pending sales
+
+// Reorder forecast: each product's sales rate is an exponentially weighted
+// moving average of its ledger records, time constant SALES_VELOCITY_DAYS,
+// folded in as each sale is recorded. Only ln(sum of units * e^(t/tau)) is kept,
+// so the rate at any later time is one exp() and nothing is rescanned. A new
+// product is not forecast until it has sold REORDER_WARMUP_SALES times over at
+// least REORDER_WARMUP_DAYS; its sum is then scaled up once as if the rate seen
+// so far had held all along, so it is not mistaken for a slow seller, while a
+// single early sale cannot pass for a whole day's (or week's) demand.
+// Days until stockout is quantity / rate. Because every rate decays by the
+// same factor, ln(quantity) - logUnits orders items by stockout time whatever
+// the clock says; each stripe's reorderOrder keeps that order, so the k items
+// closest to running out are among the first k entries of each.
+const double SALES_VELOCITY_DAYS = 14.0;
+const double SALES_VELOCITY_SECONDS = SALES_VELOCITY_DAYS * 86400.0;
+const int REORDER_LEAD_DAYS = 7;        // Items expected to run out sooner are listed and alerted
+const int REORDER_COVER_DAYS = 28;      // The suggested order refills this many days of sales
+const int REORDER_WARMUP_SALES = 3;     // Sales a new product needs before it is forecast...
+const int REORDER_WARMUP_DAYS = 3;      // ...spread over at least this many days
+
+struct SalesVelocity {
+    double logUnits = -HUGE_VAL;   // ln(sum of units * e^(timestamp / tau)) over the product's sales
+    double key = 0;                // Entry in reorderOrder, while listed
+    bool listed = false;           // In reorderOrder (the item is in stock)
+    bool alerted = false;          // Alerted since its days left last reached REORDER_LEAD_DAYS
+    bool warm = false;             // Enough sales seen for the rate to be used
+    int64_t firstSale = 0;         // While warming up: time of the first sale
+    uint32_t sales = 0;            // While warming up: sales so far
+};
+
+struct ReorderLine {
+    int productID;
+    string name;
+    int quantity;
+    double perDay;                 // Units sold per day, now
+    double daysLeft;
+    int suggested;                 // Units to order for REORDER_COVER_DAYS
+};
+
+struct PendingSale {
+    SaleRecord sale;
+    string category;               // Category at the time of the sale
+};
+
+// Sales state is striped by product ID, so tills selling different products do
+// not wait for each other: a product's velocity, its place in the forecast and
+// its sales not yet merged into the ledger all live in one stripe.
+const size_t SALES_STRIPES = 64;
+
+struct SalesStripe {
+    mutex lock;                                   // Taken last: nothing else is locked while it is held
+    vector<PendingSale> pending;                  // Recorded, not yet in the ledger and the rollups
+    unordered_map<int, SalesVelocity> velocities; // productID -> velocity
+    set<pair<double, int>> reorderOrder;          // (stockout key, productID), soonest first
 };
 
+SalesStripe salesStripes[SALES_STRIPES];
+uint64_t velocityLedgerSize = 0;  // Ledger bytes included in the velocities (salesLedgerMutex)
+
 // Global variables
-vector<StockItem> stock;
-vector<string> historyLog;
+ItemStore stock;
+// Shared category dictionary: items store an index into this list. It starts with
+// the standard options and grows when a new category is entered or loaded.
 vector<string> categoryOptions = {"Fruits", "Vegetables", "Snacks", "Beverages", "Dairy", "Meat", "Bakery", "Frozen Foods", "Other"};
-double grandTotalSales = 0.0;
+unordered_map<string, uint16_t> categoryIDs; // Category name -> position in categoryOptions
+Money grandTotalSales = 0;      // Revenue as of the last checkpoint; later sales are in revenueSlots
+bool interactive = true;   // False when running a command line mode (no pauses or screens)
+
+// Lookup indexes into stock, kept in sync by insertItem/removeItemAt/reindexItem.
+// They hold item handles, so moving an item to another position leaves them alone.
+unordered_map<int, ItemHandle> idIndex;       // productID -> handle
+unordered_map<string, ItemHandle> nameIndex;  // name -> handle
+
+// With --lazy-load the name and search indexes start out empty and are built the
+// first time a name is looked up or searched for; until then changes skip them
+atomic<bool> nameIndexReady(true);
+atomic<bool> searchIndexReady(true);
+mutex lazyIndexMutex;   // Tills may all ask for the first build at once
+
+// Columnar copy of the numeric fields, position-aligned with stock. Scans such as
+// totals and threshold filters walk these contiguous arrays instead of StockItems.
+vector<int> colProductID;
+vector<int> colQuantity;
+vector<Money> colLastPrice;
+vector<uint16_t> colCategoryID;              // Position in categoryOptions
+
+// Quantity-ordered index of (quantity, position) pairs, kept in step with
+// colQuantity, so "everything below N units" is a walk over the first k entries
+set<pair<int, uint32_t>> quantityOrder;
+int lowStockThreshold = 15;    // Quantity below which an item counts as LOW
+
+// Item tables are rendered into one reusable buffer and written in large chunks
+// (or a page at a time) instead of streaming each cell through setw
+const size_t TABLE_ID_WIDTH = 8;
+const size_t TABLE_NAME_WIDTH = 25;        // Longer names are cut to fit with "..."
+const size_t TABLE_CATEGORY_WIDTH = 15;
+const size_t TABLE_QTY_WIDTH = 8;
+const size_t TABLE_PRICE_WIDTH = 12;
+const size_t TABLE_RULE_WIDTH = 80;
+const size_t TABLE_PAGE_ROWS = 20;         // Rows per screen in viewAllItems() and makeSale()
+const size_t TABLE_FLUSH_BYTES = 64 * 1024; // Unpaged tables are written out in chunks of this size
+string tableBuffer;
+
+// Called when a sale takes an item from at/above lowStockThreshold to below it
+typedef void (*LowStockListener)(const StockItem& item, int previousQuantity);
+vector<LowStockListener> lowStockListeners;
+
+// Search index: lowercase names stored once (position-aligned with stock) plus
+// trigram posting lists. Postings are only ever appended; entries left behind by
+// deletes/renames are filtered out when candidates are verified, and the whole
+// index is rebuilt once they outnumber the live ones.
+vector<string> colNameLower;
+unordered_map<uint32_t, vector<uint32_t>> trigramPostings; // Trigram -> positions in stock
+size_t livePostings = 0;
+size_t stalePostings = 0;
+
+// Write-ahead journal: every mutation is appended here, stock.dat is only a periodic checkpoint
+const char* JOURNAL_FILE = "stock.journal";
+const int JOURNAL_SYNC_INTERVAL_MS = 200;       // Group commit window: the flusher fsyncs this often
+const long JOURNAL_CHECKPOINT_RECORDS = 10000;  // rewrite stock.dat once the journal grows this long
+FILE* journalFile = nullptr;
+long journalSequence = 0;      // Sequence number of the last record written or replayed
+long checkpointSequence = 0;   // Last sequence number already contained in stock.dat
+int journalUnsynced = 0;       // Records written since the last fsync
+bool journalDeferred = false;  // Inside a batch: records are buffered and synced/checkpointed once at the end (journalMutex)
+
+// Sharding: each store (a branch, or a range of product IDs with --shard) keeps
+// its own stock.bin and journal. With --ship a checkpoint first appends the
+// journal records it is about to truncate to stock.ship; a central node
+// (--central) replays them into its replica of the store and writes the last
+// sequence it applied to stock.ship.ack, after which the store starts
+// stock.ship afresh at its next checkpoint.
+const char* SHIP_FILE = "stock.ship";
+const char* SHIP_ACK_FILE = "stock.ship.ack";
+const char* CENTRAL_CATALOG_FILE = "central.csv"; // Per-product totals across the shards
+bool shipJournal = false;
+int shardFirstID = 1;                            // --shard: product IDs this store may add
+int shardLastID = numeric_limits<int>::max();
+
+// Concurrent tills (--tills): sales and restocks hold storeMutex shared plus the
+// stripe lock of their product ID, so tills selling different items never wait
+// for each other; adding, changing or removing items holds storeMutex exclusively.
+const size_t ITEM_LOCK_STRIPES = 64;
+shared_mutex storeMutex;
+mutex itemLocks[ITEM_LOCK_STRIPES];
+mutex quantityIndexMutex;            // Guards quantityOrder
+recursive_mutex journalMutex;        // Guards the journal file and its counters
+
+// Group commit: records are handed to the OS as they are written and a flusher
+// thread fsyncs whatever has accumulated, so many sales share one disk flush
+thread journalFlusher;
+mutex journalFlusherMutex;
+condition_variable journalFlusherWake;
+bool journalFlusherRunning = false;  // Guarded by journalFlusherMutex
+atomic<bool> concurrentMode(false);  // While tills run, checkpoints wait until they have finished
+
+// Sales revenue is added to a per-thread slot (one cache line each) and the
+// slots are summed on read, so tills never contend on a single total
+const size_t REVENUE_SLOTS = 64;
+struct alignas(64) RevenueSlot {
+    atomic<Money> amount;
+};
+RevenueSlot revenueSlots[REVENUE_SLOTS];
+atomic<size_t> nextRevenueSlot(0);
+
+// Metrics: a latency histogram per instrumented operation plus a few event
+// counters. Everything is a relaxed atomic, so tills record without locking.
+// Bucket b counts calls that took at most 2^b microseconds (the last: longer).
+enum MetricID { METRIC_LOAD_STOCK, METRIC_SAVE_STOCK, METRIC_LOG_ACTION, METRIC_SALE, METRIC_CHECKOUT,
+                METRIC_SEARCH, METRIC_COUNT };
+enum CounterID { COUNTER_JOURNAL_SYNCS, COUNTER_CHECKPOINTS, COUNTER_LOG_QUEUE_FULL, COUNTER_REJECTED_SALES,
+                 COUNTER_COUNT };
+const char* const METRIC_NAMES[METRIC_COUNT] = {"load_stock", "save_stock", "log_action", "sale", "checkout", "search"};
+const char* const COUNTER_NAMES[COUNTER_COUNT] = {"journal_syncs", "checkpoints", "log_queue_full", "rejected_sales"};
+const int METRIC_BUCKETS = 25;    // 1us .. ~16.8s, plus one for anything slower
+
+struct LatencyMetric {
+    atomic<uint64_t> count;
+    atomic<uint64_t> totalNanos;
+    atomic<uint64_t> buckets[METRIC_BUCKETS + 1];
+};
+LatencyMetric latencyMetrics[METRIC_COUNT];
+atomic<uint64_t> counters[COUNTER_COUNT];
+
+// Times the enclosing scope into one latency metric
+struct MetricTimer {
+    MetricID id;
+    chrono::steady_clock::time_point start;
+    explicit MetricTimer(MetricID metric) : id(metric), start(chrono::steady_clock::now()) {}
+    ~MetricTimer();
+};
+
+// Outcome of a stock operation, shared by the interactive screens and batch mode
+enum OpResult { OP_OK, OP_NOT_FOUND, OP_INVALID_ID, OP_DUPLICATE_ID, OP_INVALID_NAME, OP_DUPLICATE_NAME,
+                OP_INVALID_QUANTITY, OP_INSUFFICIENT_STOCK, OP_INVALID_PRICE, OP_INVALID_COMMAND, OP_MALFORMED,
+                OP_EMPTY_BASKET, OP_FIELD_COUNT, OP_WRONG_SHARD };
+
+// One line of a customer's basket; a basket is checked out as a single transaction
+struct BasketLine {
+    int productID;
+    int quantity;
+    Money price;      // Per unit
+};
+typedef vector<BasketLine> Basket;
 
 // Function declarations
 void clearScreen();                 // Clears the console screen (platform-dependent)
@@ -32,6 +701,7 @@ void displayMainMenu();            // Displays the main menu to the user
 void loadStockFromFile();          // Loads stock data from file into memory
 void saveStockToFile();            // Saves current stock data from memory to file
 void logAction(const string& action); // Logs an action (add, update, delete, sale) with timestamp
+void logAction(ActionType type, int productID, int quantity, Money price, const string& action); // Logs a structured action
 void viewStockHistory();           // Displays the history log of stock actions
 void addNewItem();                 // Adds a new item to the stock
 void viewAllItems();               // Displays all stock items in a table
@@ -40,34 +710,274 @@ void deleteItem();                 // Deletes an item from stock by ID
 void searchItem();                 // Searches for items by ID, name, or category
 void lowStockAlert();              // Shows items with quantity below a threshold
 void makeSale();                   // Handles a sale, reduces stock, and updates revenue
+bool selectSaleItem(size_t& page, size_t pages, Money sessionTotal, int salesCount,
+                    unordered_map<int, int>& inBasket, StockItem& selected); // Sale screen item lookup
 
 // Helper functions
 void loadGrandTotalFromFile();     // Loads total revenue from file
 void saveGrandTotalToFile();       // Saves updated total revenue to file
 void pauseScreen();                // Pauses the screen until user input
 bool isValidProductID(int id, int excludeIndex = -1); // Checks if product ID is unique (optional exclude during update)
+bool inShard(int id);              // Checks if a product ID is in this store's --shard range
 void displayItemTable(const vector<StockItem>& items); // Displays a list of items in table format
+void displayItemTable(const StockSnapshot& view, const vector<size_t>& indices); // Same, from a snapshot
+void displayItemRow(const StockItem& item);            // Displays one table row
+void displayItemPage(const StockSnapshot& items, size_t page); // Displays one page of TABLE_PAGE_ROWS items
+size_t tablePageCount(size_t rows);                    // Number of pages needed for this many rows
+bool readPageCommand(const string& input, size_t& page, size_t pages); // Applies N/P/page number input
+void appendTableHeader(string& out);                   // Appends the column titles and rule
+void appendItemRow(string& out, const StockItem& item); // Appends one table row
+void writeTableBuffer();                               // Writes tableBuffer to cout in one call and empties it
 bool confirmAction(const string& message); // Asks user for confirmation (yes/no)
+Money toMoney(const string& text);  // Parses an amount like "12.5" into cents (throws invalid_argument)
+bool readMoney(istream& in, Money& amount); // Reads one amount from a stream (sets failbit if invalid)
+string formatMoney(Money amount);   // Formats cents as "12.50"
+void appendMoney(string& out, Money amount); // Appends formatMoney() output without a temporary
+int findItemIndexByID(int id);     // Returns the index of the item with this product ID, or -1
+int findItemIndexByName(const string& name); // Returns the index of the item with this exact name, or -1
+
+// Index functions (every change to the set of items or their ID/name goes through these)
+void rebuildIndexes();             // Rebuilds the ID and name indexes from stock
+void buildNameIndex();             // Fills the name index from stock
+void ensureNameIndex();            // Builds the name index if --lazy-load deferred it
+void ensureSearchIndex();          // Builds the search index if --lazy-load deferred it
+
+// Snapshot functions
+bool loadStockSnapshot(const string& path); // Loads stock from a binary snapshot (mmap)
+Money doubleBitsToMoney(int64_t bits);       // Converts a pre-version-3 snapshot amount to cents
+bool saveStockSnapshot(const string& path); // Writes stock as a binary snapshot
+void serializeSnapshotSegment(const StockSnapshot& view, size_t first, size_t count, string& out); // Records + pool of one segment
+StockSnapshot captureStock();               // Point-in-time view of stock and revenue (writers must be excluded)
+bool importStockText(const string& path);   // Loads stock from the legacy text format
+bool exportStockText(const string& path);   // Writes stock in the legacy text format
+bool runCatalogImport(istream& in, const string& source); // Upserts a CSV catalog and commits it once
+int applyCatalogStream(istream& in, const string& source); // Receives each CSV row, returns the number rejected
+bool exportStockCsv(const string& path);    // Writes stock as CSV (same columns the import reads)
+vector<string> parseOptions(int argc, char* argv[]); // Applies global options, returns the remaining arguments
+bool runCommandLineMode(const vector<string>& args, int& exitCode); // Runs --import-text/--export-text/--batch
+bool runBatch(istream& in, const string& source); // Applies a file of SALE/RESTOCK/ADD/UPDATE/DELETE lines
+int applyBatchStream(istream& in, const string& source); // Applies each line, returns the number rejected
+bool runTills(const vector<string>& paths);       // Runs one batch file per thread against the shared stock
+bool runCentral(const string& shardList);         // Catches up the shard replicas and totals them
+string commandName(const string& field);          // Normalized command word of a line ("" to skip it)
+OpResult applyCommand(const string& command, const vector<string>& fields); // Applies one parsed command
+bool runServer(int port);                         // TCP line protocol server (Linux, epoll)
+bool runBenchmark(const string& dir, int items, int ops); // Synthetic catalog + workload, prints latencies
+bool runSelfTest(const string& dir);              // Round trips through the codecs and file formats, prints each check
+bool enterScratchDirectory(const string& dir);    // Makes dir the working directory and clears its data files
+string handleServerRequest(const string& line, bool& closeConnection); // Reply line for one request
+string csvField(const string& value);             // Quotes a reply field if needed
+vector<string> splitCsvLine(const string& line);   // Splits one comma separated line (double quotes allowed)
+
+// History logger functions
+void startLogger();                // Starts the background history writer
+void stopLogger();                 // Writes all queued lines and stops the writer
+void flushLogger();                // Blocks until every queued line is in history.log
+void loggerThreadMain();           // Background loop: drains the queue in batches
+void writeLogBatch(FILE* historyFile, string& batch, vector<pair<size_t, ActionType>>& batchLines); // One batched append
+bool enqueueLogLine(string& line); // Lock-free push; false if the queue is full
+bool dequeueLogLine(string& line); // Pop used only by the logger thread
+string formatTimestamp(time_t when); // ctime()-style timestamp, cached per second
+
+// History ring functions
+void recordHistory(time_t when, ActionType type, int productID, int quantity, Money price, const string& text); // Adds to the ring
+void loadRecentHistory();          // Seeds the ring from the tail of history.log at startup
+
+// History index functions
+void loadHistoryIndex();           // Loads history.idx and catches it up with history.log
+void saveHistoryIndex();           // Writes history.idx (caller holds historyIndexMutex)
+void indexHistoryLine(uint64_t offset, size_t length, ActionType type); // Counts one appended line
+ActionType classifyLogLine(const string& line); // Action type history.idx counts a logged line under
+
+// History rotation functions
+string historySegmentPath(uint64_t segment, bool compressed); // history.<n>.log or history.<n>.log.lz4
+void rotateHistoryIfDue(FILE*& historyFile); // Starts a new history.log once the current one is big or old
+void startHistoryCompression();    // Compresses rotated segments on a background thread
+void historyCompressorMain();      // Compressor thread: runs rounds until no segment is pending
+void compressHistorySegments();    // Compresses plain segments and drops the ones past HISTORY_KEEP_SEGMENTS
+bool readHistorySegment(uint64_t segment, string& text); // Text of an archived segment
+uint32_t xxHash32(const void* data, size_t length, uint32_t seed); // Checksum used by LZ4 frames
+void lz4CompressBlock(const char* data, size_t length, string& out); // Appends one LZ4 block
+bool lz4DecompressBlock(const unsigned char* data, size_t length, string& out); // Appends one decoded block
+void lz4CompressFrame(const string& text, string& out); // Whole LZ4 frame (independent blocks, content checksum)
+bool lz4DecompressFrame(const string& frame, string& text); // Reads a frame written by lz4CompressFrame()
+void insertItem(const StockItem& item); // Appends an item and indexes it
+void removeItemAt(size_t index);   // Removes an item in O(1) by moving the last item into its place
+void reindexItem(size_t index, int oldID, const string& oldName); // Refreshes index entries after an ID/name change
+
+// Column functions
+void rebuildColumns();             // Rebuilds the columnar arrays from stock
+void syncColumns(size_t index, bool sold = false); // Copies one item's fields into the columns after a change
+
+// Low stock index functions
+void rebuildQuantityIndex();       // Rebuilds quantityOrder from colQuantity
+vector<size_t> itemsInQuantityRange(int minQuantity, int maxQuantity); // Positions with min <= qty < max, by quantity
+void addLowStockListener(LowStockListener listener); // Registers a threshold-crossing callback
+void checkLowStock(size_t index, int previousQuantity); // Fires listeners if the item just crossed the threshold
+void printLowStockAlert(const StockItem& item, int previousQuantity); // Default listener (console + history)
+
+// Search index functions
+string normalizeSearchText(const string& text); // Lowercases text for matching
+vector<uint32_t> trigramsOf(const string& text); // Distinct 3-byte keys of a normalized string
+void rebuildSearchIndex();         // Rebuilds normalized names and postings from stock
+void addSearchPostings(size_t index); // Registers colNameLower[index] under its trigrams
+void retireSearchPostings(const string& normalized); // Counts an old name's postings as stale
+vector<size_t> searchStock(const string& term); // Positions of items whose name or category contains term
+
+// Concurrency functions
+mutex& itemLock(int id);           // Stripe lock that guards the item with this product ID
+void runParallel(size_t count, const function<void(size_t)>& task, bool parallel = true); // task(0..count-1) on a pool
+void addRevenue(Money amount);     // Adds to the calling thread's revenue slot
+Money totalRevenue();              // grandTotalSales plus every revenue slot
+
+// Metrics functions
+void recordLatency(MetricID id, uint64_t nanos); // Adds one timed call to a histogram
+void countEvent(CounterID id);     // Increments an event counter
+uint64_t metricPercentileMicros(MetricID id, double fraction); // Bucket bound holding that share of calls
+uint64_t metricPercentileMicros(initializer_list<MetricID> ids, double fraction); // Same over several metrics
+string formatMetricsText();        // Prometheus text exposition of every metric
+void viewStatistics();             // Menu screen with the counters and latencies
+
+// Category dictionary functions
+uint16_t internCategory(const string& name); // Returns the ID of a category, registering new ones
+const string& categoryName(uint16_t id);     // Returns the dictionary entry for an ID
+uint16_t promptNewCategory();                // Asks for a new category name and registers it
+
+// Journal functions
+void openJournal();                // Opens the journal for appending
+void closeJournal();               // Syncs and closes the journal
+void appendJournal(const string& record); // Appends one delta record (fsync is batched)
+void syncJournal();                // Forces unsynced journal records to disk
+void replayJournal();              // Applies journal records on top of the loaded checkpoint
+long applyJournalFile(const string& path, bool contiguous, bool& torn); // Applies records newer than journalSequence
+bool shipJournalRecords(long previousCheckpoint); // Appends the journal to stock.ship before a checkpoint
+void resetStore();                 // Empties stock and revenue and restarts the sequence at 0
+void checkpointStock();            // Writes stock.dat + grand_total.dat and truncates the journal
+void journalSale(int id, int qty, Money price);        // Records a sale
+void journalBasket(const Basket& basket);              // Records every line of a basket in one record
+void journalRestock(int id, int qty);                  // Records added quantity
+void journalAdd(const StockItem& item);                // Records a new item
+void journalUpdate(int oldID, const StockItem& item);  // Records the new state of an item
+void journalDelete(int id);                            // Records a deleted item
+void journalRebase();                                  // Records that stock was replaced wholesale
+string journalField(const string& value);              // Makes a string safe for a tab separated record
+string journalPrice(Money price);                      // Formats a price for a journal record
+void beginJournalBatch();          // Defers journal flushing and checkpoints until endJournalBatch()
+void endJournalBatch();            // Syncs the deferred records and writes one checkpoint
+void commitJournalGroup();         // Syncs the deferred records, checkpointing only when due
+void journalFlusherMain();         // Background group commit loop
+
+// Sales ledger functions
+void openSalesLedger();            // Loads sales.rollup, folds in newer ledger records and opens the ledger
+void closeSalesLedger();           // Flushes the ledger and writes sales.rollup
+void recordSales(const Basket& lines); // Queues sold lines for the ledger and updates the forecast (store lock held)
+void mergePendingSales();          // Writes the queued sales to the ledger and rollups (caller holds salesLedgerMutex)
+void reportSalesLedgerError();     // Reports a failed ledger write once (caller holds salesLedgerMutex)
+void addToRollups(const SaleRecord& sale, const string& category); // Counts one line (caller holds salesLedgerMutex)
+int64_t rollupBucketStart(time_t when, RollupPeriod period); // Start of the hour/local day containing when
+bool loadSalesRollups();           // Reads sales.rollup (caller holds salesLedgerMutex)
+bool saveSalesRollups();           // Writes sales.rollup (caller holds salesLedgerMutex)
+
+// Reorder forecast functions
+SalesStripe& salesStripe(int productID);          // The stripe holding a product's sales state
+void addToVelocity(SalesStripe& stripe, const SaleRecord& sale);        // Folds one sale into its product's rate (caller holds stripe.lock)
+void placeReorderKey(SalesStripe& stripe, int productID, int quantity); // Re-sorts a product in reorderOrder (caller holds stripe.lock)
+void updateForecast(int productID, int quantity);  // Same, taking the stripe lock (quantity or ID changed)
+void dropForecast(int productID);                  // Forgets a product's velocity and forecast place (item removed)
+void moveForecast(int oldID, int newID, int quantity); // Carries a product's velocity over to its new ID
+void rebuildForecastIndex();                       // Rebuilds every reorderOrder from the columns
+double forecastPerDay(const SalesVelocity& velocity, time_t now); // Units per day at now
+double forecastDaysLeft(double key, time_t now);   // Days of stock for a reorderOrder key
+vector<ReorderLine> reorderForecast(int days);     // Items out within days, soonest first (store lock held)
+ReorderLine reorderLine(const SalesVelocity& velocity, size_t index, time_t now); // Forecast row for stock[index]
+void printReorderAlert(const ReorderLine& line);   // Console + history alert
+void viewSalesReports();           // Revenue per day, hour, category and product
+FILE* openAtomicWrite(const string& path);               // Opens "<path>.tmp" for a crash-safe rewrite
+bool commitAtomicWrite(FILE* file, const string& path);  // fsyncs the temp file and renames it over path
+
+// Stock operations (validation + change + journal record, no console I/O or logging)
+OpResult applySale(size_t index, int qty, Money price);   // Sells qty units of stock[index]
+void applySaleChange(size_t index, int qty, Money price); // Quantity/price/revenue part of a sale (no checks)
+OpResult validateBasket(const Basket& basket, size_t* failedLine); // Checks every line against current stock
+OpResult applyRestock(size_t index, int qty);              // Adds qty units to stock[index]
+OpResult applyAdd(const StockItem& item);                  // Adds a new item
+OpResult applyUpdate(size_t index, const StockItem& updated); // Replaces the fields of stock[index]
+OpResult applyDelete(size_t index);                        // Removes stock[index]
+const char* opResultText(OpResult result);                 // Human readable reason for a failed operation
+
+// Inventory engine: the product ID based API that the menu and batch mode sit on.
+// Every call validates, applies, journals and logs one change and reports an
+// OpResult; nothing in here reads from cin or writes to cout.
+namespace Inventory {
+    struct BatchSummary {
+        int sold, restocked, added, changed, removed;
+        int lowStockAlerts, reorderAlerts; // Alerts raised by the batch (logged once, with its totals)
+        Money revenue;
+    };
+
+    enum BatchAlert { ALERT_LOW_STOCK, ALERT_REORDER };
+
+    struct StockOverview {
+        long long totalQuantity = 0;
+        int outOfStock = 0, low = 0;
+        vector<int> categoryCount;     // Items per category ID
+    };
+
+    OpResult sell(int id, int qty, Money price);       // Sale of qty units at price each
+    OpResult checkout(const Basket& basket, size_t* failedLine = nullptr); // All lines or none
+    OpResult restock(int id, int qty);                 // Adds qty units to an item
+    OpResult add(const StockItem& item);               // New item (ID and name must be free)
+    OpResult update(int id, const StockItem& item);    // Replaces an item's fields (the ID may change)
+    OpResult upsert(const StockItem& item);            // update() if the ID exists, add() otherwise
+    OpResult receive(const StockItem& item, const string& category); // Restock by name if it exists, add() otherwise
+    OpResult remove(int id);                           // Deletes an item
+    bool get(int id, StockItem& item);                 // Copies an item out under the store lock
+    bool getByName(const string& name, StockItem& item); // Same, for the item with this exact name
+    uint16_t category(const string& name);             // internCategory() under the store lock
+    vector<size_t> query(const string& term);          // Positions of items matching a search term
+    vector<size_t> lowStock(int threshold);            // Positions of items below threshold, lowest first
+    StockSnapshot snapshot();                          // Point-in-time view of stock for reports
+    StockSnapshot lowStockView(int threshold, vector<size_t>& outOfStock, vector<size_t>& low); // snapshot() + lowStock() split at 1 unit
+    StockSnapshot queryView(const string& term, vector<size_t>& results); // snapshot() + query(), positions in the snapshot
+    StockSnapshot overviewView(int threshold, StockOverview& overview);  // snapshot() + totals from the columns
+    vector<ReorderLine> reorder(int days);             // Items expected to run out within days, soonest first
+    Money revenue();                                   // Total sales so far
+    void beginBatch();                 // Defers journal syncs and per-change log lines
+    bool countBatchAlert(BatchAlert alert); // Inside a batch: counts the alert instead of logging it
+    BatchSummary endBatch();           // One sync + checkpoint; returns what the batch changed
+}
 
 
 
 // Main program loop: loads data, shows menu, handles user choices
-int main() {
+int main(int argc, char* argv[]) {
 
-    loadStockFromFile();
+    vector<string> args = parseOptions(argc, argv);
+    startLogger();
+    addLowStockListener(printLowStockAlert);
+
+    int exitCode = 0;
+    if (runCommandLineMode(args, exitCode)) {
+        stopLogger();
+        return exitCode;
+    }
+
+    loadRecentHistory();
     loadGrandTotalFromFile();
+    loadStockFromFile();
+    openJournal();
 
     int choice;
     do {
         displayMainMenu();
         cout << "Enter your choice: ";
         
-        while (!(cin >> choice) || choice < 1 || choice > 9) {
+        while (!(cin >> choice) || choice < 1 || choice > 11) {
             if (cin.fail()) {
                 cin.clear();
                 cin.ignore(numeric_limits<streamsize>::max(), '\n');
             }
-            cout << "Invalid input. Please enter a number between 1-9: ";
+            cout << "Invalid input. Please enter a number between 1-11: ";
         }
 
         switch (choice) {
@@ -79,14 +989,17 @@ int main() {
             case 6: searchItem(); break;
             case 7: lowStockAlert(); break;
             case 8: viewStockHistory(); break;
-            case 9:
-                saveStockToFile();
-                saveGrandTotalToFile();
+            case 9: viewSalesReports(); break;
+            case 10: viewStatistics(); break;
+            case 11:
+                checkpointStock();
+                closeJournal();
                 logAction("Program exited successfully");
+                stopLogger();
                 cout << "Data saved successfully. Good Bye....." << endl;
                 break;
         }
-    } while (choice != 9);
+    } while (choice != 11);
 
     return 0;
 }
@@ -112,13 +1025,198 @@ void displayMainMenu() {
     cout << "6. Search Item by Name" << endl;
     cout << "7. Low Stock Alert" << endl;
     cout << "8. View Stock History" << endl;
-    cout << "9. Exit" << endl;
+    cout << "9. Sales Reports" << endl;
+    cout << "10. Statistics" << endl;
+    cout << "11. Exit" << endl;
     cout << "===============================" << endl;
-    cout << "Total Revenue: $" << fixed << setprecision(2) << grandTotalSales 
+    cout << "Total Revenue: $" << formatMoney(totalRevenue()) 
          << " | Items in Stock: " << stock.size() << endl;
+    uint64_t salesCommitted = latencyMetrics[METRIC_SALE].count + latencyMetrics[METRIC_CHECKOUT].count;
+    if (salesCommitted > 0) {
+        cout << "Sales this session: " << salesCommitted << " | Sale p99: "
+             << metricPercentileMicros({METRIC_SALE, METRIC_CHECKOUT}, 0.99)
+             << " us | Search p99: " << metricPercentileMicros(METRIC_SEARCH, 0.99) << " us" << endl;
+    }
     cout << "===============================" << endl;
 }
 
+// Applies options that affect every mode and returns the other arguments
+// (the program name stays first):
+//   --log-flush-ms N     write buffered history lines every N milliseconds
+//   --log-rotate-mb N    start a new history segment once history.log reaches N MB (0: weekly only)
+//   --lazy-load          leave item names in stock.bin until they are used (large catalogs)
+//   --ship               copy the journal to stock.ship at each checkpoint for a central node
+//   --shard LO-HI        only add product IDs from LO to HI (implies --ship)
+vector<string> parseOptions(int argc, char* argv[]) {
+    vector<string> args;
+    for (int i = 0; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--log-flush-ms" && i + 1 < argc) {
+            try {
+                logFlushIntervalMs = max(1, stoi(argv[++i]));
+            } catch (...) {
+                cerr << "Invalid --log-flush-ms value, using " << logFlushIntervalMs << endl;
+            }
+            continue;
+        }
+        if (arg == "--lazy-load") {
+            lazyLoad = true;
+            continue;
+        }
+        if (arg == "--ship") {
+            shipJournal = true;
+            continue;
+        }
+        if (arg == "--shard" && i + 1 < argc) {
+            string range = argv[++i];
+            size_t dash = range.find('-', 1);
+            try {
+                int first = stoi(range.substr(0, dash));
+                int last = stoi(range.substr(dash + 1));
+                if (dash == string::npos || first < 1 || last < first) throw invalid_argument(range);
+                shardFirstID = first;
+                shardLastID = last;
+                shipJournal = true;
+            } catch (...) {
+                cerr << "Invalid --shard range " << range << ", expected LO-HI" << endl;
+            }
+            continue;
+        }
+        if (arg == "--log-rotate-mb" && i + 1 < argc) {
+            try {
+                historyRotateBytes = (uint64_t)max(0, stoi(argv[++i])) << 20;
+            } catch (...) {
+                cerr << "Invalid --log-rotate-mb value, using " << (historyRotateBytes >> 20) << endl;
+            }
+            continue;
+        }
+        args.push_back(arg);
+    }
+    return args;
+}
+
+// Handles the non-interactive command line options:
+//   --import-text FILE   replace the catalog with a text-format stock file
+//   --export-text FILE   write the current catalog in text format
+//   --import-csv FILE    add/restock items from a CSV catalog ("-" reads standard input)
+//   --export-csv FILE    write the current catalog as CSV
+//   --batch FILE         apply the commands in FILE ("-" reads standard input)
+//   --tills FILE...      run each command file as a concurrent till
+//   --server PORT        accept register connections on a TCP port
+//   --bench DIR [ITEMS [OPS]]  benchmark a synthetic catalog in DIR (its data files are replaced)
+//   --central FILE       catch up the replicas of the shards listed in FILE and write central.csv
+//   --selftest DIR       check the LZ4/xxHash32 code and the file formats in DIR (its data files are replaced)
+bool runCommandLineMode(const vector<string>& args, int& exitCode) {
+    if (args.size() < 2) return false;
+
+    const string& mode = args[1];
+    if (mode != "--import-text" && mode != "--export-text" && mode != "--batch" && mode != "--tills" &&
+        mode != "--server" && mode != "--bench" && mode != "--import-csv" && mode != "--export-csv" &&
+        mode != "--central" && mode != "--selftest") {
+        cerr << "Unknown option: " << mode << endl;
+        exitCode = 1;
+        return true;
+    }
+    if (args.size() < 3) {
+        cerr << "Usage: " << args[0] << " " << mode << " FILE" << endl;
+        exitCode = 1;
+        return true;
+    }
+    const string& path = args[2];
+
+    interactive = false;
+    if (mode == "--bench") {
+        // The benchmark makes its own data, so nothing is loaded here
+        int items = 100000, ops = 200000;
+        try {
+            if (args.size() > 3) items = stoi(args[3]);
+            if (args.size() > 4) ops = stoi(args[4]);
+        } catch (...) {
+            items = 0;
+        }
+        if (items < 1 || items > 10000000 || ops < 1) {
+            cerr << "Usage: " << args[0] << " --bench DIR [ITEMS (1-10000000) [OPS]]" << endl;
+            exitCode = 1;
+            return true;
+        }
+        if (!runBenchmark(path, items, ops)) exitCode = 1;
+        return true;
+    }
+    if (mode == "--central") {
+        // The central node only holds replicas of the shards, not a store of its own
+        if (!runCentral(path)) exitCode = 1;
+        return true;
+    }
+    if (mode == "--selftest") {
+        if (!runSelfTest(path)) exitCode = 1;
+        return true;
+    }
+
+    loadGrandTotalFromFile();
+    loadStockFromFile();
+
+    if (mode == "--server") {
+        int port = 0;
+        try {
+            port = stoi(path);
+        } catch (...) {}
+        if (port <= 0 || port > 65535) {
+            cerr << "Invalid port: " << path << endl;
+            exitCode = 1;
+            return true;
+        }
+        openJournal();
+        if (!runServer(port)) exitCode = 1;
+        closeJournal();
+    } else if (mode == "--tills") {
+        openJournal();
+        if (!runTills(vector<string>(args.begin() + 2, args.end()))) exitCode = 1;
+        closeJournal();
+    } else if (mode == "--batch" || mode == "--import-csv") {
+        openJournal();
+        bool ok;
+        auto run = mode == "--batch" ? runBatch : runCatalogImport;
+        if (path == "-") {
+            ok = run(cin, "standard input");
+        } else {
+            ifstream batchFile(path);
+            if (!batchFile.is_open()) {
+                cerr << "Could not read " << path << endl;
+                closeJournal();
+                exitCode = 1;
+                return true;
+            }
+            ok = run(batchFile, path);
+        }
+        closeJournal();
+        if (!ok) exitCode = 1;
+    } else if (mode == "--import-text") {
+        if (!importStockText(path)) {
+            cerr << "Could not read " << path << endl;
+            exitCode = 1;
+            return true;
+        }
+        if (shipJournal) {
+            // The import is not made of journal records, so the central node is
+            // told to copy the checkpoint below instead
+            openJournal();
+            journalRebase();
+            closeJournal();
+        }
+        checkpointStock();
+        logAction("Imported " + to_string(stock.size()) + " items from " + path);
+        cout << "Imported " << stock.size() << " items from " << path << endl;
+    } else {
+        if (!(mode == "--export-csv" ? exportStockCsv(path) : exportStockText(path))) {
+            cerr << "Could not write " << path << endl;
+            exitCode = 1;
+            return true;
+        }
+        cout << "Exported " << stock.size() << " items to " << path << endl;
+    }
+    return true;
+}
+
 // Pauses and waits for user to press Enter
 void pauseScreen() {
     cout << "\nPress Enter to continue...";
@@ -126,127 +1224,4311 @@ void pauseScreen() {
     cin.get();
 }
 
-// Checks if a product ID is valid and unique (optionally excluding an index)
-bool isValidProductID(int id, int excludeIndex) {
-    if (id <= 0) return false;
-    for (size_t i = 0; i < stock.size(); ++i) {
-        if ((int)i != excludeIndex && stock[i].productID == id) {
-            return;
+// Checks if a product ID is valid and unique (optionally excluding an index)
+bool isValidProductID(int id, int excludeIndex) {
+    if (id <= 0) return false;
+    int index = findItemIndexByID(id);
+    return index < 0 || index == excludeIndex;
+}
+
+// Checks if a product ID is in this store's --shard range (always, without one)
+bool inShard(int id) {
+    return id >= shardFirstID && id <= shardLastID;
+}
+
+// Prompts user for Y/N confirmation
+bool confirmAction(const string& message) {
+    char choice;
+    cout << message << " (Y/N): ";
+    cin >> choice;
+    return (toupper(choice) == 'Y');
+}
+
+// Parses an amount of money into cents. Up to two decimals are exact; further
+// digits are rounded, so older values such as "0.69999999999999996" become 70.
+Money toMoney(const string& text) {
+    size_t i = text.find_first_not_of(" \t");
+    size_t end = text.find_last_not_of(" \t\r");
+    if (i == string::npos) throw invalid_argument("empty amount");
+    if (text.find_first_of("eE") != string::npos) {
+        // Exponent form (very old journals): the whole field must be one plain
+        // decimal number, so "5e" or "1e5abc" are rejected, not cut short
+        string number = text.substr(i, end - i + 1);
+        if (number.find_first_not_of("0123456789+-.eE") != string::npos) throw invalid_argument("not an amount: " + text);
+        size_t used = 0;
+        double value = stod(number, &used);
+        if (used != number.size()) throw invalid_argument("not an amount: " + text);
+        if (!(fabs(value) < 1e16)) throw out_of_range("amount too large");
+        return (Money)llround(value * 100.0);
+    }
+
+    bool negative = false;
+    if (text[i] == '-' || text[i] == '+') negative = text[i++] == '-';
+    Money whole = 0, cents = 0;
+    int wholeDigits = 0, decimals = 0;
+    bool roundUp = false;
+    for (; i <= end && isdigit((unsigned char)text[i]); ++i, ++wholeDigits) {
+        if (wholeDigits >= 16) throw out_of_range("amount too large");
+        whole = whole * 10 + (text[i] - '0');
+    }
+    if (i <= end && text[i] == '.') {
+        for (++i; i <= end && isdigit((unsigned char)text[i]); ++i, ++decimals) {
+            if (decimals < 2) cents = cents * 10 + (text[i] - '0');
+            else if (decimals == 2) roundUp = text[i] >= '5';
+        }
+    }
+    if (i <= end || wholeDigits + decimals == 0) throw invalid_argument("not an amount: " + text);
+    if (decimals == 1) cents *= 10;
+    else if (decimals == 0) cents = 0;
+
+    Money amount = whole * 100 + cents + (roundUp ? 1 : 0);
+    return negative ? -amount : amount;
+}
+
+// Reads one whitespace separated amount; on bad input the stream's failbit is set
+// so callers can use the usual cin.clear()/ignore() recovery
+bool readMoney(istream& in, Money& amount) {
+    string token;
+    if (!(in >> token)) return false;
+    try {
+        amount = toMoney(token);
+        return true;
+    } catch (...) {
+        in.setstate(ios::failbit);
+        return false;
+    }
+}
+
+string formatMoney(Money amount) {
+    string text;
+    appendMoney(text, amount);
+    return text;
+}
+
+// Writes digits straight into a small buffer; no streams or locale involved
+void appendMoney(string& out, Money amount) {
+    char buffer[24];
+    char* end = buffer + sizeof(buffer);
+    char* p = end;
+    uint64_t value = amount < 0 ? 0 - (uint64_t)amount : (uint64_t)amount;
+    uint64_t cents = value % 100;
+    value /= 100;
+    *--p = (char)('0' + cents % 10);
+    *--p = (char)('0' + cents / 10);
+    *--p = '.';
+    do {
+        *--p = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+    if (amount < 0) *--p = '-';
+    out.append(p, end - p);
+}
+
+// Appends text left aligned in a column of the given width. When truncate is set,
+// text that would not leave a gap before the next column is cut and ends in "..."
+static void appendCell(string& out, const char* text, size_t length, size_t width, bool truncate) {
+    if (truncate && length > width - 2) {
+        out.append(text, width - 3);
+        out.append("...");
+        return;
+    }
+    out.append(text, length);
+    if (length < width) out.append(width - length, ' ');
+}
+
+static void appendNumberCell(string& out, long long value, size_t width) {
+    char digits[24];
+    char* end = to_chars(digits, digits + sizeof(digits), value).ptr;
+    appendCell(out, digits, end - digits, width, false);
+}
+
+void appendTableHeader(string& out) {
+    static const string header = [] {
+        string text;
+        appendCell(text, "ID", 2, TABLE_ID_WIDTH, false);
+        appendCell(text, "Product Name", 12, TABLE_NAME_WIDTH, false);
+        appendCell(text, "Category", 8, TABLE_CATEGORY_WIDTH, false);
+        appendCell(text, "Qty", 3, TABLE_QTY_WIDTH, false);
+        appendCell(text, "Last Price", 10, TABLE_PRICE_WIDTH, false);
+        text += "Status\n";
+        text.append(TABLE_RULE_WIDTH, '-');
+        text += '\n';
+        return text;
+    }();
+    out += header;
+}
+
+void appendItemRow(string& out, const StockItem& item) {
+    const string& category = categoryName(item.categoryID);
+    appendNumberCell(out, item.productID, TABLE_ID_WIDTH);
+    appendCell(out, item.name.data(), item.name.size(), TABLE_NAME_WIDTH, true);
+    appendCell(out, category.data(), category.size(), TABLE_CATEGORY_WIDTH, true);
+    appendNumberCell(out, item.quantity, TABLE_QTY_WIDTH);
+    if (item.lastPrice > 0) {
+        size_t start = out.size();
+        out += '$';
+        appendMoney(out, item.lastPrice);
+        size_t length = out.size() - start;
+        if (length < TABLE_PRICE_WIDTH) out.append(TABLE_PRICE_WIDTH - length, ' ');
+    } else {
+        appendCell(out, "Not Set", 7, TABLE_PRICE_WIDTH, false);
+    }
+
+    if (item.quantity <= 0) out += "OUT\n";
+    else if (item.quantity < lowStockThreshold) out += "LOW\n";
+    else out += "OK\n";
+}
+
+void writeTableBuffer() {
+    cout.write(tableBuffer.data(), tableBuffer.size());
+    tableBuffer.clear(); // Keeps its capacity for the next table
+}
+
+// Displays a formatted table of stock items
+void displayItemTable(const vector<StockItem>& items) {
+    if (items.empty()) {
+        cout << "No items to display." << endl;
+        return;
+    }
+
+    tableBuffer.clear();
+    appendTableHeader(tableBuffer);
+    for (const auto& item : items) {
+        appendItemRow(tableBuffer, item);
+        if (tableBuffer.size() >= TABLE_FLUSH_BYTES) writeTableBuffer();
+    }
+    tableBuffer.append(TABLE_RULE_WIDTH, '-');
+    tableBuffer += '\n';
+    writeTableBuffer();
+}
+
+// Displays a formatted table of the items at the given positions in a snapshot
+void displayItemTable(const StockSnapshot& view, const vector<size_t>& indices) {
+    if (indices.empty()) {
+        cout << "No items to display." << endl;
+        return;
+    }
+
+    tableBuffer.clear();
+    appendTableHeader(tableBuffer);
+    for (size_t index : indices) {
+        appendItemRow(tableBuffer, view[index]);
+        if (tableBuffer.size() >= TABLE_FLUSH_BYTES) writeTableBuffer();
+    }
+    tableBuffer.append(TABLE_RULE_WIDTH, '-');
+    tableBuffer += '\n';
+    writeTableBuffer();
+}
+
+// Displays one item as a table row
+void displayItemRow(const StockItem& item) {
+    tableBuffer.clear();
+    appendItemRow(tableBuffer, item);
+    writeTableBuffer();
+}
+
+size_t tablePageCount(size_t rows) {
+    return rows == 0 ? 1 : (rows + TABLE_PAGE_ROWS - 1) / TABLE_PAGE_ROWS;
+}
+
+// Displays rows [page * TABLE_PAGE_ROWS, ...) of items with a page footer; the
+// whole page goes out in a single write
+void displayItemPage(const StockSnapshot& items, size_t page) {
+    if (items.empty()) {
+        cout << "No items to display." << endl;
+        return;
+    }
+
+    size_t pages = tablePageCount(items.size());
+    if (page >= pages) page = pages - 1;
+    size_t first = page * TABLE_PAGE_ROWS;
+    size_t last = min(first + TABLE_PAGE_ROWS, items.size());
+
+    tableBuffer.clear();
+    appendTableHeader(tableBuffer);
+    for (size_t i = first; i < last; ++i) {
+        appendItemRow(tableBuffer, items[i]);
+    }
+    tableBuffer.append(TABLE_RULE_WIDTH, '-');
+    tableBuffer += "\nPage ";
+    appendNumberCell(tableBuffer, (long long)page + 1, 0);
+    tableBuffer += " of ";
+    appendNumberCell(tableBuffer, (long long)pages, 0);
+    tableBuffer += " (items ";
+    appendNumberCell(tableBuffer, (long long)first + 1, 0);
+    tableBuffer += '-';
+    appendNumberCell(tableBuffer, (long long)last, 0);
+    tableBuffer += " of ";
+    appendNumberCell(tableBuffer, (long long)items.size(), 0);
+    tableBuffer += ")\n";
+    writeTableBuffer();
+}
+
+// Moves page for "N" (next), "P" (previous) or "G<number>" (go to page).
+// Returns false if the input is not a paging command.
+bool readPageCommand(const string& input, size_t& page, size_t pages) {
+    if (input.empty()) return false;
+    char command = (char)toupper((unsigned char)input[0]);
+    if (input.size() == 1 && command == 'N') {
+        if (page + 1 < pages) page++;
+        return true;
+    }
+    if (input.size() == 1 && command == 'P') {
+        if (page > 0) page--;
+        return true;
+    }
+    if (command == 'G' && input.size() > 1) {
+        size_t target = 0;
+        auto parsed = from_chars(input.data() + 1, input.data() + input.size(), target);
+        if (parsed.ec != errc() || parsed.ptr != input.data() + input.size() || target == 0) return false;
+        page = min(target, pages) - 1;
+        return true;
+    }
+    return false;
+}
+
+// Loads the grand total sales from file
+void loadGrandTotalFromFile() {
+    ifstream file("grand_total.dat");
+    if (file.is_open()) {
+        readMoney(file, grandTotalSales); // Older files hold a floating point total, rounded to cents here
+        if (!(file >> checkpointSequence)) checkpointSequence = 0; // Older files have no sequence
+        journalSequence = checkpointSequence;
+        file.close();
+    }
+}
+
+// Saves the grand total sales to file
+// (the snapshot header holds the same values; this file is kept for older snapshots)
+void saveGrandTotalToFile() {
+    FILE* file = openAtomicWrite("grand_total.dat");
+    if (!file) return;
+    fprintf(file, "%s\n%ld\n", formatMoney(totalRevenue()).c_str(), checkpointSequence);
+    commitAtomicWrite(file, "grand_total.dat");
+}
+
+// Loads stock data into memory: the binary snapshot if there is one, otherwise
+// the legacy text file; then replays the journal on top
+void loadStockFromFile() {
+    MetricTimer timer(METRIC_LOAD_STOCK);
+    if (!loadStockSnapshot(SNAPSHOT_FILE) && !importStockText(TEXT_STOCK_FILE)) {
+        stock.clear();
+        rebuildIndexes();
+        replayJournal();
+        if (interactive && stock.empty()) {
+            cout << "No existing stock file found. Starting fresh." << endl;
+            pauseScreen();
+        }
+        return;
+    }
+
+    replayJournal();
+    logAction("Stock data loaded successfully (" + to_string(stock.size()) + " items)");
+}
+
+// Saves current stock data as a binary snapshot
+void saveStockToFile() {
+    if (!saveStockSnapshot(SNAPSHOT_FILE)) {
+        cerr << "Error saving stock data!" << endl;
+    }
+}
+
+// Versions 1 and 2 of the snapshot stored amounts as doubles in the same 8 bytes
+Money doubleBitsToMoney(int64_t bits) {
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return (Money)llround(value * 100.0);
+}
+
+// Maps a binary snapshot into memory and builds stock directly from its records.
+// Returns false if the file is missing or not a valid snapshot.
+bool loadStockSnapshot(const string& path) {
+    const char* data = nullptr;
+    size_t size = 0;
+    shared_ptr<const void> mapping; // Released on return unless names point into it
+
+    #ifdef _WIN32
+        // No mmap here, so read the whole file into one buffer instead (kept like
+        // the mapping when names are loaded lazily)
+        ifstream file(path, ios::binary | ios::ate);
+        if (!file.is_open()) return false;
+        size = (size_t)file.tellg();
+        shared_ptr<string> buffer = make_shared<string>(size, '\0');
+        file.seekg(0);
+        file.read(&(*buffer)[0], size);
+        if (!file) return false;
+        data = buffer->data();
+        mapping = buffer;
+    #else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(SnapshotHeader)) {
+            close(fd);
+            return false;
+        }
+        size = (size_t)info.st_size;
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED) return false;
+        data = (const char*)mapped;
+        mapping = shared_ptr<const void>(mapped, [size](const void* address) { munmap((void*)address, size); });
+    #endif
+
+    bool valid = false;
+    SnapshotHeader header = {};
+    size_t headerSize = SNAPSHOT_V1_HEADER_SIZE;
+    if (size >= SNAPSHOT_V1_HEADER_SIZE) {
+        memcpy(&header, data, SNAPSHOT_V1_HEADER_SIZE);
+        if (header.version >= 2) headerSize = sizeof(header);
+        if (size >= headerSize) memcpy(&header, data, headerSize);
+        // Each size is checked against the file before they are added up, so a
+        // damaged header cannot wrap the sum around to the file length
+        uint64_t recordBytes = (uint64_t)header.itemCount * sizeof(SnapshotRecord);
+        bool sizesFit = recordBytes <= size && header.poolSize <= size &&
+                        headerSize + recordBytes + header.poolSize == size;
+        valid = memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) == 0 &&
+                header.version >= 1 && header.version <= SNAPSHOT_VERSION &&
+                (header.version >= 4 || sizesFit); // Version 4 sizes are checked per segment
+    }
+
+    // Work out where each part's records and pool are. Version 4 files list their
+    // segments; older files have one pool, shared by fixed-size ranges of records.
+    struct SnapshotPart {
+        const char* records;  // Not always 8-byte aligned: a version 4 pool is any length
+        const char* pool;
+        uint64_t poolSize;
+        size_t first;
+        size_t count;
+    };
+    vector<SnapshotPart> parts;
+    if (valid && header.version >= 4) {
+        uint64_t segmentCount = 0;
+        if (size >= headerSize + sizeof(segmentCount)) memcpy(&segmentCount, data + headerSize, sizeof(segmentCount));
+        uint64_t tableEnd = headerSize + sizeof(segmentCount) + segmentCount * sizeof(SnapshotSegment);
+        valid = segmentCount <= header.itemCount + 1 && tableEnd <= size;
+        uint64_t items = 0, end = tableEnd;
+        for (uint64_t i = 0; valid && i < segmentCount; ++i) {
+            SnapshotSegment segment;
+            memcpy(&segment, data + headerSize + sizeof(segmentCount) + i * sizeof(segment), sizeof(segment));
+            // offset == end <= size, and itemCount is bounded by the header's 32-bit
+            // count, so poolStart cannot overflow; the pool is compared with what is left
+            valid = segment.offset == end && segment.itemCount <= header.itemCount - items;
+            uint64_t poolStart = segment.offset + segment.itemCount * sizeof(SnapshotRecord);
+            valid = valid && poolStart <= size && segment.poolSize <= size - poolStart;
+            if (!valid) break;
+            parts.push_back({data + segment.offset, data + poolStart, segment.poolSize,
+                             (size_t)items, (size_t)segment.itemCount});
+            items += segment.itemCount;
+            end = poolStart + segment.poolSize;
+        }
+        valid = valid && items == header.itemCount && end == size;
+    } else if (valid) {
+        const char* records = data + headerSize;
+        const char* pool = records + (size_t)header.itemCount * sizeof(SnapshotRecord);
+        for (size_t first = 0; first < header.itemCount; first += SNAPSHOT_SEGMENT_ITEMS) {
+            parts.push_back({records + first * sizeof(SnapshotRecord), pool, header.poolSize, first,
+                             min(SNAPSHOT_SEGMENT_ITEMS, (size_t)header.itemCount - first)});
+        }
+    }
+
+    if (valid) {
+        stock.clear();
+        stock.resize(header.itemCount);
+
+        // Parts are parsed in parallel. Category strings are shared in a pool, so
+        // each part collects its distinct ones and they are interned afterwards.
+        vector<vector<string>> partCategories(parts.size());
+        atomic<bool> partsValid(true);
+        bool parallel = header.itemCount >= PARALLEL_MIN_ITEMS;
+        runParallel(parts.size(), [&](size_t p) {
+            const SnapshotPart& part = parts[p];
+            unordered_map<uint32_t, uint16_t> categoryByOffset;
+            for (size_t i = 0; i < part.count; ++i) {
+                SnapshotRecord record;
+                memcpy(&record, part.records + i * sizeof(SnapshotRecord), sizeof(record));
+                if ((uint64_t)record.nameOffset + record.nameLength > part.poolSize ||
+                    (uint64_t)record.categoryOffset + record.categoryLength > part.poolSize) {
+                    partsValid = false;
+                    return;
+                }
+                StockItem& item = stock.edit(part.first + i);
+                item.productID = record.productID;
+                item.quantity = record.quantity;
+                item.lastPrice = header.version >= 3 ? record.lastPrice : doubleBitsToMoney(record.lastPrice);
+                item.dateAdded = (time_t)record.dateAdded;
+                if (lazyLoad) {
+                    item.name = ItemName::mapped(part.pool + record.nameOffset, record.nameLength);
+                } else {
+                    item.name.assign(part.pool + record.nameOffset, record.nameLength);
+                }
+                auto cat = categoryByOffset.find(record.categoryOffset);
+                if (cat == categoryByOffset.end()) {
+                    cat = categoryByOffset.emplace(record.categoryOffset, (uint16_t)partCategories[p].size()).first;
+                    partCategories[p].emplace_back(part.pool + record.categoryOffset, record.categoryLength);
+                }
+                item.categoryID = cat->second; // Part-local until remapped below
+            }
+        }, parallel);
+        valid = partsValid;
+
+        if (valid) {
+            vector<vector<uint16_t>> globalIDs(parts.size());
+            for (size_t p = 0; p < parts.size(); ++p) {
+                for (const string& category : partCategories[p]) globalIDs[p].push_back(internCategory(category));
+            }
+            runParallel(parts.size(), [&](size_t p) {
+                for (size_t i = parts[p].first; i < parts[p].first + parts[p].count; ++i) {
+                    stock.edit(i).categoryID = globalIDs[p][stock[i].categoryID];
+                }
+            }, parallel);
+        }
+        if (!valid) stock.clear();
+    }
+
+    if (valid && lazyLoad) {
+        // Names are now read from the file as they are used, so no readahead
+        #ifndef _WIN32
+            madvise((void*)data, size, MADV_RANDOM);
+        #endif
+        stock.keepMapping(mapping);
+    }
+
+    if (!valid) {
+        cerr << "Ignoring invalid stock snapshot " << path << endl;
+        return false;
+    }
+    if (header.version >= 2) {
+        // Revenue and sequence were committed with the items; they win over grand_total.dat
+        grandTotalSales = header.version >= 3 ? header.revenue : doubleBitsToMoney(header.revenue);
+        checkpointSequence = journalSequence = (long)header.sequence;
+    }
+    rebuildIndexes();
+    return true;
+}
+
+// Takes a point-in-time view of stock, its revenue and the category dictionary.
+// Only the block pointers are copied; the caller keeps writers out for that long
+// (storeMutex held exclusively, or no tills running).
+StockSnapshot captureStock() {
+    StockSnapshot view = stock.snapshot();
+    view.revenue = totalRevenue();
+    view.categories = categoryOptions;
+    return view;
+}
+
+// Writes stock as a binary snapshot. The items are captured first and the
+// segments serialized from that view (in parallel, into their own buffers), then
+// written out in order behind the header and table.
+bool saveStockSnapshot(const string& path) {
+    MetricTimer timer(METRIC_SAVE_STOCK);
+    StockSnapshot view = captureStock();
+    size_t segmentCount = (view.size() + SNAPSHOT_SEGMENT_ITEMS - 1) / SNAPSHOT_SEGMENT_ITEMS;
+    vector<string> segments(segmentCount);
+    runParallel(segmentCount, [&view, &segments](size_t s) {
+        size_t first = s * SNAPSHOT_SEGMENT_ITEMS;
+        serializeSnapshotSegment(view, first, min(SNAPSHOT_SEGMENT_ITEMS, view.size() - first), segments[s]);
+    }, view.size() >= PARALLEL_MIN_ITEMS);
+
+    SnapshotHeader header;
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version = SNAPSHOT_VERSION;
+    header.itemCount = (uint32_t)view.size();
+    header.poolSize = 0;
+    header.revenue = view.revenue;
+    header.sequence = checkpointSequence;
+
+    uint64_t count = segmentCount;
+    vector<SnapshotSegment> table(segmentCount);
+    uint64_t offset = sizeof(header) + sizeof(count) + segmentCount * sizeof(SnapshotSegment);
+    for (size_t s = 0; s < segmentCount; ++s) {
+        if (segments[s].empty() && view.size() > s * SNAPSHOT_SEGMENT_ITEMS) return false; // Pool too large
+        table[s].offset = offset;
+        table[s].itemCount = min(SNAPSHOT_SEGMENT_ITEMS, view.size() - s * SNAPSHOT_SEGMENT_ITEMS);
+        table[s].poolSize = segments[s].size() - table[s].itemCount * sizeof(SnapshotRecord);
+        header.poolSize += table[s].poolSize;
+        offset += segments[s].size();
+    }
+
+    FILE* file = openAtomicWrite(path);
+    if (!file) return false;
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(&count, sizeof(count), 1, file);
+    fwrite(table.data(), sizeof(SnapshotSegment), table.size(), file);
+    for (const string& segment : segments) fwrite(segment.data(), 1, segment.size(), file);
+    return commitAtomicWrite(file, path);
+}
+
+// Builds one segment: the records of view[first, first + count) followed by
+// their string pool. Category strings are stored once per segment. Leaves out
+// empty if the pool would not fit the 32-bit offsets.
+void serializeSnapshotSegment(const StockSnapshot& view, size_t first, size_t count, string& out) {
+    vector<SnapshotRecord> records(count);
+    string pool;
+    unordered_map<uint16_t, uint32_t> categoryOffsets; // Category ID -> pool offset
+
+    for (size_t i = 0; i < count; ++i) {
+        const StockItem& item = view[first + i];
+        SnapshotRecord& record = records[i];
+        record.productID = item.productID;
+        record.quantity = item.quantity;
+        record.lastPrice = item.lastPrice;
+        record.dateAdded = (int64_t)item.dateAdded;
+
+        record.nameOffset = (uint32_t)pool.size();
+        record.nameLength = (uint32_t)item.name.size();
+        pool.append(item.name.data(), item.name.size());
+
+        const string& category = view.category(item.categoryID);
+        auto found = categoryOffsets.find(item.categoryID);
+        if (found == categoryOffsets.end()) {
+            found = categoryOffsets.emplace(item.categoryID, (uint32_t)pool.size()).first;
+            pool += category;
+        }
+        record.categoryOffset = found->second;
+        record.categoryLength = (uint32_t)category.size();
+    }
+    if (pool.size() > UINT32_MAX) return;
+
+    out.resize(count * sizeof(SnapshotRecord) + pool.size());
+    if (count > 0) memcpy(&out[0], records.data(), count * sizeof(SnapshotRecord));
+    if (!pool.empty()) memcpy(&out[count * sizeof(SnapshotRecord)], pool.data(), pool.size());
+}
+
+// Starts a crash-safe rewrite of path: everything goes to "<path>.tmp" first
+FILE* openAtomicWrite(const string& path) {
+    return fopen((path + ".tmp").c_str(), "wb");
+}
+
+// Finishes openAtomicWrite(): the temp file is forced to disk and then renamed
+// over path, so readers see either the old file or the complete new one
+bool commitAtomicWrite(FILE* file, const string& path) {
+    string tempPath = path + ".tmp";
+    bool ok = fflush(file) == 0 && !ferror(file);
+    #ifdef _WIN32
+        ok = ok && _commit(_fileno(file)) == 0;
+        ok = (fclose(file) == 0) && ok;
+        ok = ok && MoveFileExA(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+    #else
+        ok = ok && fsync(fileno(file)) == 0;
+        ok = (fclose(file) == 0) && ok;
+        ok = ok && rename(tempPath.c_str(), path.c_str()) == 0;
+        if (ok) {
+            // Make the rename itself durable
+            size_t slash = path.find_last_of('/');
+            string directory = slash == string::npos ? "." : path.substr(0, max<size_t>(slash, 1));
+            int fd = open(directory.c_str(), O_RDONLY);
+            if (fd >= 0) {
+                fsync(fd);
+                close(fd);
+            }
+        }
+    #endif
+    if (!ok) remove(tempPath.c_str());
+    return ok;
+}
+
+// Loads stock from the legacy text format (six lines per item)
+bool importStockText(const string& path) {
+    ifstream file(path);
+    if (!file.is_open()) return false;
+
+    stock.clear();
+    StockItem item;
+    string name, category;
+    while (file >> item.productID && file.ignore() &&
+           getline(file, name) &&
+           getline(file, category) &&
+           file >> item.quantity && readMoney(file, item.lastPrice) && file >> item.dateAdded && file.ignore()) {
+        item.name = name;
+        item.categoryID = internCategory(category);
+        stock.push_back(item);
+    }
+    file.close();
+    rebuildIndexes();
+    return true;
+}
+
+// Writes stock in the legacy text format
+bool exportStockText(const string& path) {
+    StockSnapshot view = captureStock();
+    FILE* file = openAtomicWrite(path);
+    if (!file) return false;
+
+    // Written EXPORT_FLUSH_BYTES at a time, so memory use does not grow with the catalog
+    string text;
+    text.reserve(EXPORT_FLUSH_BYTES + 1024);
+    for (size_t i = 0; i < view.size(); ++i) {
+        const StockItem& item = view[i];
+        text += to_string(item.productID);
+        text += '\n';
+        text.append(item.name.data(), item.name.size());
+        text += '\n';
+        text += view.category(item.categoryID);
+        text += '\n';
+        text += to_string(item.quantity);
+        text += '\n';
+        appendMoney(text, item.lastPrice);
+        text += '\n';
+        text += to_string((long long)item.dateAdded);
+        text += '\n';
+        if (text.size() >= EXPORT_FLUSH_BYTES) {
+            fwrite(text.data(), 1, text.size(), file);
+            text.clear();
+        }
+    }
+    fwrite(text.data(), 1, text.size(), file);
+    return commitAtomicWrite(file, path);
+}
+
+// Writes stock as CSV with a header row, in the column order runCatalogImport()
+// reads, from a snapshot and a buffer at a time like exportStockText()
+bool exportStockCsv(const string& path) {
+    StockSnapshot view = Inventory::snapshot();
+    FILE* file = openAtomicWrite(path);
+    if (!file) return false;
+
+    string text = "id,name,category,quantity,price,date_added\n";
+    text.reserve(EXPORT_FLUSH_BYTES + 1024);
+    for (size_t i = 0; i < view.size(); ++i) {
+        const StockItem& item = view[i];
+        text += to_string(item.productID);
+        text += ',';
+        text += csvField(item.name);
+        text += ',';
+        text += csvField(view.category(item.categoryID));
+        text += ',';
+        text += to_string(item.quantity);
+        text += ',';
+        appendMoney(text, item.lastPrice);
+        text += ',';
+        text += to_string((long long)item.dateAdded);
+        text += '\n';
+        if (text.size() >= EXPORT_FLUSH_BYTES) {
+            fwrite(text.data(), 1, text.size(), file);
+            text.clear();
+        }
+    }
+    fwrite(text.data(), 1, text.size(), file);
+    return commitAtomicWrite(file, path);
+}
+
+// Returns the position of the item with the given product ID, or -1 if missing
+int findItemIndexByID(int id) {
+    auto it = idIndex.find(id);
+    return it == idIndex.end() ? -1 : (int)stock.positionOf(it->second);
+}
+
+// Returns the position of the item with the given name, or -1 if missing
+int findItemIndexByName(const string& name) {
+    ensureNameIndex();
+    auto it = nameIndex.find(name);
+    return it == nameIndex.end() ? -1 : (int)stock.positionOf(it->second);
+}
+
+// Rebuilds both indexes (and the columns) from scratch after loading a checkpoint.
+// If the file contains duplicates, the first occurrence wins like the old linear scans.
+// The ID index, name index, columns and search index only read stock, so large
+// catalogs build all four at the same time. With --lazy-load only the ID index
+// and columns are built here; the other two wait until they are first needed.
+void rebuildIndexes() {
+    nameIndexReady = !lazyLoad;
+    searchIndexReady = !lazyLoad;
+    runParallel(4, [](size_t part) {
+        if (part == 0) {
+            idIndex.clear();
+            idIndex.reserve(stock.size());
+            for (size_t i = 0; i < stock.size(); ++i) idIndex.emplace(stock[i].productID, stock.handleAt(i));
+        } else if (part == 1) {
+            nameIndex.clear();
+            if (!lazyLoad) buildNameIndex();
+        } else if (part == 2) {
+            rebuildColumns();
+        } else if (lazyLoad) {
+            colNameLower.clear();
+            trigramPostings.clear();
+            livePostings = stalePostings = 0;
+        } else {
+            rebuildSearchIndex();
+        }
+    }, stock.size() >= PARALLEL_MIN_ITEMS);
+}
+
+void buildNameIndex() {
+    nameIndex.reserve(stock.size());
+    for (size_t i = 0; i < stock.size(); ++i) nameIndex.emplace(stock[i].name, stock.handleAt(i));
+}
+
+// The deferred builds read every name once. Callers hold the store lock shared
+// at least, so the names cannot change meanwhile.
+void ensureNameIndex() {
+    if (nameIndexReady.load(memory_order_acquire)) return;
+    lock_guard<mutex> lock(lazyIndexMutex);
+    if (nameIndexReady.load(memory_order_relaxed)) return;
+    buildNameIndex();
+    nameIndexReady.store(true, memory_order_release);
+}
+
+void ensureSearchIndex() {
+    if (searchIndexReady.load(memory_order_acquire)) return;
+    lock_guard<mutex> lock(lazyIndexMutex);
+    if (searchIndexReady.load(memory_order_relaxed)) return;
+    rebuildSearchIndex();
+    searchIndexReady.store(true, memory_order_release);
+}
+
+// Adds an item to the end of stock and registers it in the indexes
+void insertItem(const StockItem& item) {
+    ItemHandle handle = stock.push_back(item);
+    idIndex.emplace(item.productID, handle);
+    if (nameIndexReady) nameIndex.emplace(item.name, handle);
+
+    colProductID.push_back(item.productID);
+    colQuantity.push_back(item.quantity);
+    colLastPrice.push_back(item.lastPrice);
+    colCategoryID.push_back(item.categoryID);
+    quantityOrder.emplace(item.quantity, (uint32_t)(stock.size() - 1));
+    updateForecast(item.productID, item.quantity);
+
+    if (searchIndexReady) {
+        colNameLower.push_back(normalizeSearchText(item.name));
+        addSearchPostings(stock.size() - 1);
+    }
+}
+
+// Removes the item at index by moving the last item into the gap, so nothing is
+// shifted. The moved item keeps its handle, so only the position-aligned
+// columns and the search postings follow it.
+void removeItemAt(size_t index) {
+    const StockItem& removed = stock[index];
+    ItemHandle handle = stock.handleAt(index);
+    bool searchIndexed = searchIndexReady;
+    if (searchIndexed) retireSearchPostings(colNameLower[index]);
+    quantityOrder.erase(make_pair(colQuantity[index], (uint32_t)index));
+    auto idIt = idIndex.find(removed.productID);
+    if (idIt != idIndex.end() && idIt->second == handle) {
+        idIndex.erase(idIt);
+        dropForecast(removed.productID);
+    }
+    if (nameIndexReady) {
+        auto nameIt = nameIndex.find(removed.name);
+        if (nameIt != nameIndex.end() && nameIt->second == handle) nameIndex.erase(nameIt);
+    }
+
+    size_t last = stock.size() - 1;
+    if (index != last) {
+        quantityOrder.erase(make_pair(colQuantity[last], (uint32_t)last));
+        quantityOrder.emplace(colQuantity[last], (uint32_t)index);
+        colProductID[index] = colProductID[last];
+        colQuantity[index] = colQuantity[last];
+        colLastPrice[index] = colLastPrice[last];
+        colCategoryID[index] = colCategoryID[last];
+
+        // The moved item's postings still point at 'last'; add ones for its new slot
+        if (searchIndexed) {
+            colNameLower[index] = std::move(colNameLower[last]);
+            retireSearchPostings(colNameLower[index]);
+            addSearchPostings(index);
+        }
+    }
+    stock.removeAt(index);
+    colProductID.pop_back();
+    colQuantity.pop_back();
+    colLastPrice.pop_back();
+    colCategoryID.pop_back();
+    if (searchIndexed) colNameLower.pop_back();
+
+    if (searchIndexed && stalePostings > 1024 && stalePostings > livePostings) {
+        rebuildSearchIndex();
+    }
+}
+
+// Moves the index entries of an item whose product ID and/or name changed
+void reindexItem(size_t index, int oldID, const string& oldName) {
+    const StockItem& item = stock[index];
+    ItemHandle handle = stock.handleAt(index);
+    if (item.productID != oldID) {
+        auto it = idIndex.find(oldID);
+        if (it != idIndex.end() && it->second == handle) idIndex.erase(it);
+        idIndex[item.productID] = handle;
+    }
+    if (item.name != oldName && nameIndexReady) {
+        auto it = nameIndex.find(oldName);
+        if (it != nameIndex.end() && it->second == handle) nameIndex.erase(it);
+        nameIndex[item.name] = handle;
+    }
+    if (item.name != oldName && searchIndexReady) {
+        retireSearchPostings(colNameLower[index]);
+        colNameLower[index] = normalizeSearchText(item.name);
+        addSearchPostings(index);
+    }
+    syncColumns(index);
+}
+
+// Rebuilds the quantity index from the column in one sorted pass
+void rebuildQuantityIndex() {
+    vector<pair<int, uint32_t>> entries(colQuantity.size());
+    for (size_t i = 0; i < colQuantity.size(); ++i) {
+        entries[i] = make_pair(colQuantity[i], (uint32_t)i);
+    }
+    sort(entries.begin(), entries.end());
+    quantityOrder = set<pair<int, uint32_t>>(entries.begin(), entries.end());
+}
+
+// Returns positions of items with minQuantity <= quantity < maxQuantity, lowest
+// quantity first, in O(log n + k)
+vector<size_t> itemsInQuantityRange(int minQuantity, int maxQuantity) {
+    vector<size_t> positions;
+    lock_guard<mutex> lock(quantityIndexMutex);
+    for (auto it = quantityOrder.lower_bound(make_pair(minQuantity, 0u));
+         it != quantityOrder.end() && it->first < maxQuantity; ++it) {
+        positions.push_back(it->second);
+    }
+    return positions;
+}
+
+// Registers a function to call whenever a sale pushes an item below the threshold
+void addLowStockListener(LowStockListener listener) {
+    lowStockListeners.push_back(listener);
+}
+
+// Notifies listeners if stock[index] was at/above the threshold before and is below it now
+void checkLowStock(size_t index, int previousQuantity) {
+    const StockItem& item = stock[index];
+    if (previousQuantity >= lowStockThreshold && item.quantity < lowStockThreshold) {
+        for (LowStockListener listener : lowStockListeners) {
+            listener(item, previousQuantity);
+        }
+    }
+}
+
+// Default low stock listener: tells the cashier and records it in the history
+void printLowStockAlert(const StockItem& item, int previousQuantity) {
+    string status = item.quantity <= 0 ? "OUT OF STOCK" : "LOW STOCK";
+    if (interactive) {
+        cout << "\n*** " << status << ": " << item.name << " dropped from " << previousQuantity
+             << " to " << item.quantity << " units (threshold " << lowStockThreshold << ") ***" << endl;
+    }
+    if (Inventory::countBatchAlert(Inventory::ALERT_LOW_STOCK)) return;
+    logAction(ACTION_OTHER, item.productID, item.quantity, item.lastPrice,
+              status + " ALERT: " + item.name + " (ID: " + to_string(item.productID) +
+              ", Remaining: " + to_string(item.quantity) + ")");
+}
+
+// Lowercases text once so searches never transform names per query
+string normalizeSearchText(const string& text) {
+    string normalized = text;
+    transform(normalized.begin(), normalized.end(), normalized.begin(), ::tolower);
+    return normalized;
+}
+
+// Returns each distinct trigram of a normalized string packed into 24 bits
+vector<uint32_t> trigramsOf(const string& text) {
+    vector<uint32_t> trigrams;
+    if (text.size() < 3) return trigrams;
+    trigrams.reserve(text.size() - 2);
+    for (size_t i = 0; i + 2 < text.size(); ++i) {
+        trigrams.push_back(((uint32_t)(unsigned char)text[i] << 16) |
+                           ((uint32_t)(unsigned char)text[i + 1] << 8) |
+                           (uint32_t)(unsigned char)text[i + 2]);
+    }
+    sort(trigrams.begin(), trigrams.end());
+    trigrams.erase(unique(trigrams.begin(), trigrams.end()), trigrams.end());
+    return trigrams;
+}
+
+// Recomputes every normalized name and posting list
+// Names are normalized and split into trigrams by chunk on several threads; the
+// chunks are then merged in order, so posting lists stay sorted by position.
+void rebuildSearchIndex() {
+    const size_t chunkItems = 16384;
+    trigramPostings.clear();
+    livePostings = 0;
+    stalePostings = 0;
+    size_t count = stock.size();
+    colNameLower.resize(count);
+    size_t chunks = (count + chunkItems - 1) / chunkItems;
+    size_t wave = max<size_t>(1, thread::hardware_concurrency()); // Chunks held in memory at once
+    vector<vector<pair<uint32_t, uint32_t>>> chunkPostings(min(chunks, wave)); // (trigram, position)
+    for (size_t firstChunk = 0; firstChunk < chunks; firstChunk += wave) {
+        size_t waveChunks = min(wave, chunks - firstChunk);
+        runParallel(waveChunks, [&](size_t c) {
+            vector<pair<uint32_t, uint32_t>>& postings = chunkPostings[c];
+            postings.clear();
+            size_t first = (firstChunk + c) * chunkItems;
+            for (size_t i = first; i < min(first + chunkItems, count); ++i) {
+                colNameLower[i] = normalizeSearchText(stock[i].name);
+                for (uint32_t trigram : trigramsOf(colNameLower[i])) postings.emplace_back(trigram, (uint32_t)i);
+            }
+        }, count >= PARALLEL_MIN_ITEMS);
+        for (size_t c = 0; c < waveChunks; ++c) {
+            for (const auto& posting : chunkPostings[c]) trigramPostings[posting.first].push_back(posting.second);
+            livePostings += chunkPostings[c].size();
+        }
+    }
+}
+
+// Files position index under every trigram of its normalized name
+void addSearchPostings(size_t index) {
+    for (uint32_t trigram : trigramsOf(colNameLower[index])) {
+        trigramPostings[trigram].push_back((uint32_t)index);
+        livePostings++;
+    }
+}
+
+// Marks the postings of a name that is going away as stale (they stay in the
+// lists until the next rebuild and are rejected during verification)
+void retireSearchPostings(const string& normalized) {
+    size_t count = normalized.size() < 3 ? 0 : trigramsOf(normalized).size();
+    livePostings -= min(livePostings, count);
+    stalePostings += count;
+}
+
+// Finds items whose name or category contains term (case-insensitive).
+// Terms of three or more characters only verify the candidates from the
+// rarest trigram's posting list; shorter terms scan the normalized names.
+vector<size_t> searchStock(const string& term) {
+    ensureSearchIndex();
+    string needle = normalizeSearchText(term);
+    vector<size_t> results;
+
+    // Match the term against each dictionary entry once instead of per item
+    vector<bool> categoryMatches(categoryOptions.size());
+    bool anyCategory = false;
+    for (size_t i = 0; i < categoryOptions.size(); ++i) {
+        categoryMatches[i] = normalizeSearchText(categoryOptions[i]).find(needle) != string::npos;
+        anyCategory = anyCategory || categoryMatches[i];
+    }
+    if (anyCategory) {
+        for (size_t i = 0; i < colCategoryID.size(); ++i) {
+            if (categoryMatches[colCategoryID[i]]) results.push_back(i);
+        }
+    }
+
+    if (needle.size() < 3) {
+        for (size_t i = 0; i < colNameLower.size(); ++i) {
+            if ((!anyCategory || !categoryMatches[colCategoryID[i]]) &&
+                colNameLower[i].find(needle) != string::npos) {
+                results.push_back(i);
+            }
+        }
+    } else {
+        const vector<uint32_t>* rarest = nullptr;
+        for (uint32_t trigram : trigramsOf(needle)) {
+            auto it = trigramPostings.find(trigram);
+            if (it == trigramPostings.end()) {
+                rarest = nullptr; // Some trigram occurs in no name at all
+                break;
+            }
+            if (!rarest || it->second.size() < rarest->size()) rarest = &it->second;
+        }
+        if (rarest) {
+            for (uint32_t index : *rarest) {
+                if (index < colNameLower.size() &&
+                    (!anyCategory || !categoryMatches[colCategoryID[index]]) &&
+                    colNameLower[index].find(needle) != string::npos) {
+                    results.push_back(index);
+                }
+            }
+        }
+    }
+
+    // Stale postings can repeat a position, and category hits come first
+    sort(results.begin(), results.end());
+    results.erase(unique(results.begin(), results.end()), results.end());
+    return results;
+}
+
+// Fills the columnar arrays (and the quantity index) from stock
+void rebuildColumns() {
+    size_t count = stock.size();
+    colProductID.resize(count);
+    colQuantity.resize(count);
+    colLastPrice.resize(count);
+    colCategoryID.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        const StockItem& item = stock[i];
+        colProductID[i] = item.productID;
+        colQuantity[i] = item.quantity;
+        colLastPrice[i] = item.lastPrice;
+        colCategoryID[i] = item.categoryID;
+    }
+    rebuildQuantityIndex();
+    rebuildForecastIndex();
+}
+
+// Copies the numeric fields of stock[index] into the columns; every path that
+// changes quantity, price, ID or category calls this afterwards. The reorder
+// forecast follows quantity and ID too, except after a sale (sold): then
+// recordSales() re-sorts the item once, when its sales rate has changed as well.
+void syncColumns(size_t index, bool sold) {
+    const StockItem& item = stock[index];
+    if (colQuantity[index] != item.quantity) {
+        lock_guard<mutex> lock(quantityIndexMutex);
+        quantityOrder.erase(make_pair(colQuantity[index], (uint32_t)index));
+        quantityOrder.emplace(item.quantity, (uint32_t)index);
+    }
+    if (colProductID[index] != item.productID) {
+        moveForecast(colProductID[index], item.productID, item.quantity);
+    } else if (colQuantity[index] != item.quantity && !sold) {
+        updateForecast(item.productID, item.quantity);
+    }
+    colProductID[index] = item.productID;
+    colQuantity[index] = item.quantity;
+    colLastPrice[index] = item.lastPrice;
+    colCategoryID[index] = item.categoryID;
+}
+
+// Product IDs are spread over the stripes, so two tills only share a lock when
+// their items happen to land on the same stripe
+mutex& itemLock(int id) {
+    return itemLocks[(unsigned)id % ITEM_LOCK_STRIPES];
+}
+
+// Runs task(0) .. task(count - 1) on up to hardware_concurrency() threads, the
+// caller included; each thread takes the next unstarted task until none are left.
+// With parallel false (or a single task) everything runs on the calling thread.
+void runParallel(size_t count, const function<void(size_t)>& task, bool parallel) {
+    size_t workers = parallel ? min(count, (size_t)max(1u, thread::hardware_concurrency())) : 1;
+    if (workers <= 1) {
+        for (size_t i = 0; i < count; ++i) task(i);
+        return;
+    }
+    atomic<size_t> next(0);
+    auto worker = [&next, count, &task]() {
+        for (size_t i = next++; i < count; i = next++) task(i);
+    };
+    vector<thread> threads;
+    for (size_t w = 1; w < workers; ++w) threads.emplace_back(worker);
+    worker();
+    for (thread& t : threads) t.join();
+}
+
+// Adds a sale amount to this thread's slot. Threads are handed slots in turn;
+// a slot is only shared when more than REVENUE_SLOTS threads have sold something.
+void addRevenue(Money amount) {
+    thread_local size_t slot = nextRevenueSlot++ % REVENUE_SLOTS;
+    revenueSlots[slot].amount.fetch_add(amount, memory_order_relaxed);
+}
+
+Money totalRevenue() {
+    Money total = grandTotalSales;
+    for (size_t i = 0; i < REVENUE_SLOTS; ++i) {
+        total += revenueSlots[i].amount.load(memory_order_relaxed);
+    }
+    return total;
+}
+
+MetricTimer::~MetricTimer() {
+    recordLatency(id, (uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+}
+
+void recordLatency(MetricID id, uint64_t nanos) {
+    LatencyMetric& metric = latencyMetrics[id];
+    uint64_t micros = (nanos + 999) / 1000;
+    int bucket = 0;
+    while (bucket < METRIC_BUCKETS && (1ULL << bucket) < micros) bucket++;
+    metric.count.fetch_add(1, memory_order_relaxed);
+    metric.totalNanos.fetch_add(nanos, memory_order_relaxed);
+    metric.buckets[bucket].fetch_add(1, memory_order_relaxed);
+}
+
+void countEvent(CounterID id) {
+    counters[id].fetch_add(1, memory_order_relaxed);
+}
+
+// Upper bound of the bucket that holds the given share of calls; an estimate
+// within a factor of two, which is enough to see where time goes
+uint64_t metricPercentileMicros(MetricID id, double fraction) {
+    return metricPercentileMicros({id}, fraction);
+}
+
+// Like above, with the calls of every listed metric counted together (all
+// kinds of sale, say)
+uint64_t metricPercentileMicros(initializer_list<MetricID> ids, double fraction) {
+    uint64_t count = 0;
+    for (MetricID id : ids) count += latencyMetrics[id].count.load(memory_order_relaxed);
+    if (count == 0) return 0;
+    uint64_t target = (uint64_t)ceil(fraction * count), seen = 0;
+    for (int bucket = 0; bucket < METRIC_BUCKETS; ++bucket) {
+        for (MetricID id : ids) seen += latencyMetrics[id].buckets[bucket].load(memory_order_relaxed);
+        if (seen >= target) return 1ULL << bucket;
+    }
+    return 1ULL << METRIC_BUCKETS;
+}
+
+// Metrics in the Prometheus text format (histograms in seconds, cumulative buckets)
+string formatMetricsText() {
+    ostringstream text;
+    text << "# HELP stock_operation_seconds Time spent in instrumented operations.\n"
+         << "# TYPE stock_operation_seconds histogram\n";
+    for (int id = 0; id < METRIC_COUNT; ++id) {
+        const LatencyMetric& metric = latencyMetrics[id];
+        string label = string("op=\"") + METRIC_NAMES[id] + "\"";
+        uint64_t cumulative = 0;
+        for (int bucket = 0; bucket < METRIC_BUCKETS; ++bucket) {
+            cumulative += metric.buckets[bucket].load(memory_order_relaxed);
+            text << "stock_operation_seconds_bucket{" << label << ",le=\"" << (double)(1ULL << bucket) / 1e6
+                 << "\"} " << cumulative << "\n";
+        }
+        cumulative += metric.buckets[METRIC_BUCKETS].load(memory_order_relaxed);
+        text << "stock_operation_seconds_bucket{" << label << ",le=\"+Inf\"} " << cumulative << "\n"
+             << "stock_operation_seconds_sum{" << label << "} " << metric.totalNanos.load(memory_order_relaxed) / 1e9 << "\n"
+             << "stock_operation_seconds_count{" << label << "} " << metric.count.load(memory_order_relaxed) << "\n";
+    }
+    for (int id = 0; id < COUNTER_COUNT; ++id) {
+        text << "# TYPE stock_" << COUNTER_NAMES[id] << "_total counter\n"
+             << "stock_" << COUNTER_NAMES[id] << "_total " << counters[id].load(memory_order_relaxed) << "\n";
+    }
+    text << "# TYPE stock_items gauge\n"
+         << "stock_items " << colQuantity.size() << "\n"
+         << "# TYPE stock_revenue gauge\n"
+         << "stock_revenue " << formatMoney(totalRevenue()) << "\n";
+    return text.str();
+}
+
+// Maps a category name to its dictionary ID. Names that are not in the
+// dictionary yet (entered by the user or found in a file) are appended.
+uint16_t internCategory(const string& name) {
+    if (categoryIDs.empty()) {
+        for (size_t i = 0; i < categoryOptions.size(); ++i) {
+            categoryIDs.emplace(categoryOptions[i], (uint16_t)i);
+        }
+    }
+    auto it = categoryIDs.find(name);
+    if (it != categoryIDs.end()) return it->second;
+
+    if (categoryOptions.size() >= UINT16_MAX) {
+        return internCategory("Other"); // Dictionary full
+    }
+    uint16_t id = (uint16_t)categoryOptions.size();
+    categoryOptions.push_back(name);
+    categoryIDs.emplace(name, id);
+    return id;
+}
+
+// Returns the category name for an ID
+const string& categoryName(uint16_t id) {
+    static const string unknown = "Other";
+    return id < categoryOptions.size() ? categoryOptions[id] : unknown;
+}
+
+// Reads the name of a new category (the caller has already consumed the rest of
+// the previous input line) and adds it to the dictionary
+uint16_t promptNewCategory() {
+    string name;
+    do {
+        cout << "Enter new category name: ";
+        getline(cin, name);
+    } while (name.empty());
+    return internCategory(name);
+}
+
+// Opens the journal in append mode so new records go after the existing ones
+// and starts the group commit flusher
+void openJournal() {
+    openSalesLedger();
+    {
+        lock_guard<recursive_mutex> lock(journalMutex);
+        journalFile = fopen(JOURNAL_FILE, "a");
+        if (!journalFile) {
+            cerr << "Error opening stock journal! Changes will be written to stock.dat directly." << endl;
+        }
+    }
+
+    lock_guard<mutex> flusherLock(journalFlusherMutex);
+    if (!journalFlusherRunning) {
+        journalFlusherRunning = true;
+        journalFlusher = thread(journalFlusherMain);
+    }
+}
+
+// Stops the flusher, flushes any unsynced records and closes the journal
+void closeJournal() {
+    {
+        lock_guard<mutex> flusherLock(journalFlusherMutex);
+        journalFlusherRunning = false;
+    }
+    journalFlusherWake.notify_all();
+    if (journalFlusher.joinable()) journalFlusher.join();
+
+    closeSalesLedger();
+    lock_guard<recursive_mutex> lock(journalMutex);
+    if (!journalFile) return;
+    syncJournal();
+    fclose(journalFile);
+    journalFile = nullptr;
+}
+
+// Pushes buffered journal records to the OS and forces them to disk
+void syncJournal() {
+    lock_guard<recursive_mutex> lock(journalMutex);
+    if (!journalFile) return;
+    fflush(journalFile);
+    #ifdef _WIN32
+        _commit(_fileno(journalFile));
+    #else
+        fsync(fileno(journalFile));
+    #endif
+    journalUnsynced = 0;
+    countEvent(COUNTER_JOURNAL_SYNCS);
+}
+
+// Background group commit: every JOURNAL_SYNC_INTERVAL_MS, one fsync covers
+// all records appended since the last one. Deferred (batch) records are left
+// for the batch to commit.
+void journalFlusherMain() {
+    unique_lock<mutex> flusherLock(journalFlusherMutex);
+    while (journalFlusherRunning) {
+        journalFlusherWake.wait_for(flusherLock, chrono::milliseconds(JOURNAL_SYNC_INTERVAL_MS));
+        flusherLock.unlock();
+        {
+            lock_guard<recursive_mutex> lock(journalMutex);
+            if (journalUnsynced > 0 && !journalDeferred) syncJournal();
+        }
+        {
+            lock_guard<mutex> lock(salesLedgerMutex);
+            mergePendingSales();
+            if (salesLedgerFile) {
+                if (fflush(salesLedgerFile) != 0) reportSalesLedgerError();
+                else salesLedgerFailing = false;
+            }
+        }
+        flusherLock.lock();
+    }
+}
+
+// Appends one record to the journal. Each record is handed to the OS right away
+// (so a program crash loses nothing); the fsync is left to the flusher thread,
+// which covers every record of the last JOURNAL_SYNC_INTERVAL_MS with one call.
+void appendJournal(const string& record) {
+    lock_guard<recursive_mutex> lock(journalMutex);
+    if (!journalFile) {
+        if (journalDeferred || concurrentMode) return; // The batch/tills end with a checkpoint
+        // No journal available, fall back to the old full rewrite
+        saveStockToFile();
+        saveGrandTotalToFile();
+        return;
+    }
+
+    fputs((to_string(++journalSequence) + '\t' + record + '\n').c_str(), journalFile);
+    journalUnsynced++;
+    if (journalDeferred) return; // Left in the stdio buffer until the batch/group is committed
+    fflush(journalFile);
+
+    if (!concurrentMode && journalSequence - checkpointSequence >= JOURNAL_CHECKPOINT_RECORDS) {
+        checkpointStock();
+    }
+}
+
+// Journal fields are tab separated, so tabs inside names are stored as spaces
+string journalField(const string& value) {
+    string field = value;
+    replace(field.begin(), field.end(), '\t', ' ');
+    return field;
+}
+
+// Prices are journaled as exact decimals ("12.50"); toMoney() reads them back
+string journalPrice(Money price) {
+    return formatMoney(price);
+}
+
+void journalSale(int id, int qty, Money price) {
+    appendJournal("SALE\t" + to_string(id) + '\t' + to_string(qty) + '\t' + journalPrice(price));
+}
+
+void journalBasket(const Basket& basket) {
+    string record = "BASKET\t" + to_string(basket.size());
+    for (const BasketLine& line : basket) {
+        record += '\t' + to_string(line.productID) + '\t' + to_string(line.quantity) + '\t' + journalPrice(line.price);
+    }
+    appendJournal(record);
+}
+
+void journalRestock(int id, int qty) {
+    appendJournal("RESTOCK\t" + to_string(id) + '\t' + to_string(qty));
+}
+
+void journalAdd(const StockItem& item) {
+    appendJournal("ADD\t" + to_string(item.productID) + '\t' + journalField(item.name) + '\t' +
+                  journalField(categoryName(item.categoryID)) + '\t' + to_string(item.quantity) + '\t' +
+                  journalPrice(item.lastPrice) + '\t' + to_string(item.dateAdded));
+}
+
+void journalUpdate(int oldID, const StockItem& item) {
+    appendJournal("UPDATE\t" + to_string(oldID) + '\t' + to_string(item.productID) + '\t' +
+                  journalField(item.name) + '\t' + journalField(categoryName(item.categoryID)) + '\t' +
+                  to_string(item.quantity) + '\t' + journalPrice(item.lastPrice));
+}
+
+void journalDelete(int id) {
+    appendJournal("DELETE\t" + to_string(id));
+}
+
+void journalRebase() {
+    appendJournal("REBASE\t0");
+}
+
+// Starts a batch: records keep being written to the journal, but without a
+// flush or fsync per record and without intermediate checkpoints. The flag is
+// set under journalMutex, where the flusher thread reads it.
+void beginJournalBatch() {
+    lock_guard<recursive_mutex> lock(journalMutex);
+    journalDeferred = true;
+}
+
+// Ends a batch with one fsync and one checkpoint covering all of its records
+void endJournalBatch() {
+    lock_guard<recursive_mutex> lock(journalMutex);
+    journalDeferred = false;
+    syncJournal();
+    checkpointStock();
+}
+
+// Group commit for the server: one fsync for every record deferred since the
+// last call (nothing when there were none), plus a checkpoint once one is due
+void commitJournalGroup() {
+    lock_guard<recursive_mutex> lock(journalMutex);
+    journalDeferred = false;
+    if (journalUnsynced > 0) syncJournal();
+    if (journalSequence - checkpointSequence >= JOURNAL_CHECKPOINT_RECORDS) {
+        checkpointStock();
+    }
+}
+
+// Replays journal records newer than the checkpoint on top of the loaded stock
+void replayJournal() {
+    bool torn = false;
+    applyJournalFile(JOURNAL_FILE, false, torn);
+
+    // Fold the replayed records into a fresh checkpoint so the journal starts clean
+    if (torn || journalSequence > checkpointSequence) {
+        checkpointStock();
+    }
+}
+
+// Applies the records of a journal file newer than journalSequence and returns
+// how many there were. A torn last record (no trailing newline after a crash)
+// is ignored and reported through torn. A replica (contiguous) can only follow
+// the records one by one: a missing sequence number or a REBASE record stops
+// it with -1, and it has to start over from the store's checkpoint.
+long applyJournalFile(const string& path, bool contiguous, bool& torn) {
+    ifstream journal(path);
+    if (!journal.is_open()) return 0;
+
+    string line;
+    long applied = 0;
+    while (getline(journal, line)) {
+        if (journal.eof()) {
+            torn = true; // Incomplete final record
+            break;
+        }
+
+        vector<string> fields;
+        string field;
+        istringstream in(line);
+        while (getline(in, field, '\t')) fields.push_back(field);
+        if (fields.size() < 3) continue;
+
+        try {
+            long seq = stol(fields[0]);
+            if (seq <= journalSequence) continue; // Already part of stock.dat
+            if (contiguous && (seq != journalSequence + 1 || fields[1] == "REBASE")) return -1;
+            journalSequence = seq;
+            applied++;
+
+            const string& type = fields[1];
+            int index = findItemIndexByID(stoi(fields[2]));
+
+            if (type == "SALE" && fields.size() >= 5 && index >= 0) {
+                applySaleChange(index, stoi(fields[3]), toMoney(fields[4]));
+            } else if (type == "BASKET") {
+                size_t count = stoul(fields[2]);
+                if (fields.size() < 3 + count * 3) continue; // Torn basket: none of it happened
+                for (size_t i = 0; i < count; ++i) {
+                    int lineIndex = findItemIndexByID(stoi(fields[3 + i * 3]));
+                    if (lineIndex >= 0) {
+                        applySaleChange(lineIndex, stoi(fields[4 + i * 3]), toMoney(fields[5 + i * 3]));
+                    }
+                }
+            } else if (type == "RESTOCK" && fields.size() >= 4 && index >= 0) {
+                stock.edit(index).quantity += stoi(fields[3]);
+                syncColumns(index);
+            } else if (type == "ADD" && fields.size() >= 8 && index < 0) {
+                StockItem item;
+                item.productID = stoi(fields[2]);
+                item.name = fields[3];
+                item.categoryID = internCategory(fields[4]);
+                item.quantity = stoi(fields[5]);
+                item.lastPrice = toMoney(fields[6]);
+                item.dateAdded = (time_t)stoll(fields[7]);
+                insertItem(item);
+            } else if (type == "UPDATE" && fields.size() >= 8 && index >= 0) {
+                StockItem& item = stock.edit(index);
+                string oldName = item.name;
+                int oldID = item.productID;
+                item.productID = stoi(fields[3]);
+                item.name = fields[4];
+                item.categoryID = internCategory(fields[5]);
+                item.quantity = stoi(fields[6]);
+                item.lastPrice = toMoney(fields[7]);
+                reindexItem(index, oldID, oldName);
+            } else if (type == "DELETE" && index >= 0) {
+                removeItemAt(index);
+            }
+        } catch (...) {
+            // Skip malformed records
+        }
+    }
+    return applied;
+}
+
+// Writes a full checkpoint (stock.bin with the revenue, plus grand_total.dat) and
+// empties the journal. The journal is only truncated once the new snapshot is
+// safely in place; until then a crash simply replays it on top of the old one.
+void checkpointStock() {
+    lock_guard<recursive_mutex> lock(journalMutex);
+    countEvent(COUNTER_CHECKPOINTS);
+    bool wasOpen = journalFile != nullptr;
+    if (wasOpen) {
+        syncJournal();
+        fclose(journalFile);
+        journalFile = nullptr;
+    }
+
+    long previousCheckpoint = checkpointSequence;
+    checkpointSequence = journalSequence;
+    if (saveStockSnapshot(SNAPSHOT_FILE)) {
+        saveGrandTotalToFile();
+        if (shipJournal && !shipJournalRecords(previousCheckpoint)) {
+            cerr << "Error shipping stock journal! Keeping it for the next checkpoint." << endl;
+        } else {
+            // Truncate the journal now that everything in it is part of the checkpoint
+            FILE* truncated = fopen(JOURNAL_FILE, "w");
+            if (truncated) fclose(truncated);
+        }
+    } else {
+        cerr << "Error saving stock data! Keeping the journal." << endl;
+        checkpointSequence = previousCheckpoint;
+    }
+
+    if (wasOpen) {
+        journalFile = fopen(JOURNAL_FILE, "a");
+        if (!journalFile) cerr << "Error reopening stock journal!" << endl;
+    }
+}
+
+// Copies the complete records of the (closed) journal to the end of stock.ship.
+// Once the central node has acknowledged everything up to previousCheckpoint,
+// stock.ship only holds records it has already applied and is started afresh.
+// On failure stock.ship is cut back to where it was, so it never ends up with
+// half a record in the middle.
+bool shipJournalRecords(long previousCheckpoint) {
+    long acked = -1;
+    ifstream ack(SHIP_ACK_FILE);
+    if (!(ack >> acked)) acked = -1;
+    ack.close();
+
+    string records;
+    ifstream journal(JOURNAL_FILE, ios::binary | ios::ate);
+    if (journal.is_open()) {
+        records.resize((size_t)journal.tellg());
+        journal.seekg(0);
+        journal.read(&records[0], records.size());
+        if (!journal) return false;
+        size_t end = records.rfind('\n');
+        records.resize(end == string::npos ? 0 : end + 1); // A torn record was never committed
+    }
+
+    FILE* ship = fopen(SHIP_FILE, acked >= previousCheckpoint ? "wb" : "ab");
+    if (!ship) return false;
+    fseek(ship, 0, SEEK_END);
+    long start = ftell(ship);
+    bool ok = fwrite(records.data(), 1, records.size(), ship) == records.size() && fflush(ship) == 0;
+    #ifdef _WIN32
+        ok = ok && _commit(_fileno(ship)) == 0;
+        if (!ok) _chsize(_fileno(ship), start);
+    #else
+        ok = ok && fsync(fileno(ship)) == 0;
+        if (!ok && ftruncate(fileno(ship), start) != 0) cerr << "Could not cut stock.ship back to its last record!" << endl;
+    #endif
+    return (fclose(ship) == 0) && ok;
+}
+
+// Empties the in-memory store: no items, no revenue and sequence 0, as for a
+// store that has never been checkpointed
+void resetStore() {
+    stock.clear();
+    rebuildIndexes();
+    grandTotalSales = 0;
+    for (size_t i = 0; i < REVENUE_SLOTS; ++i) revenueSlots[i].amount.store(0, memory_order_relaxed);
+    checkpointSequence = journalSequence = 0;
+}
+
+// Loads the rollups, catches them up with the ledger and opens the ledger for
+// writing at the end of its last complete record
+void openSalesLedger() {
+    lock_guard<mutex> lock(salesLedgerMutex);
+    for (auto& buckets : salesRollups) buckets.clear();
+    for (SalesStripe& stripe : salesStripes) {
+        lock_guard<mutex> stripeLock(stripe.lock);
+        stripe.pending.clear();
+        stripe.velocities.clear();
+    }
+    salesLedgerSize = velocityLedgerSize = 0;
+    loadSalesRollups();
+
+    ifstream ledger(SALES_LEDGER_FILE, ios::binary | ios::ate);
+    uint64_t actualSize = ledger.is_open() ? (uint64_t)ledger.tellg() : 0;
+    if (actualSize < salesLedgerSize || actualSize < velocityLedgerSize) {
+        // The ledger was replaced or truncated: rebuild the totals from what is there
+        for (auto& buckets : salesRollups) buckets.clear();
+        for (SalesStripe& stripe : salesStripes) {
+            lock_guard<mutex> stripeLock(stripe.lock);
+            stripe.velocities.clear();
+        }
+        salesLedgerSize = velocityLedgerSize = 0;
+    }
+    // A version 1 sales.rollup has no velocities, so those start from the
+    // beginning of the ledger once
+    uint64_t offset = min(salesLedgerSize, velocityLedgerSize);
+    if (ledger.is_open() && actualSize - offset >= sizeof(SaleRecord)) {
+        ledger.seekg((streamoff)offset);
+        SaleRecord sale;
+        while (ledger.read((char*)&sale, sizeof(sale))) {
+            if (offset >= salesLedgerSize) {
+                // Categories are not in the ledger; use the item's current one
+                int index = findItemIndexByID(sale.productID);
+                addToRollups(sale, index >= 0 ? categoryName(stock[index].categoryID) : string("Unknown"));
+                salesLedgerSize += sizeof(sale);
+            }
+            if (offset >= velocityLedgerSize) {
+                SalesStripe& stripe = salesStripe(sale.productID);
+                lock_guard<mutex> stripeLock(stripe.lock);
+                addToVelocity(stripe, sale);
+                velocityLedgerSize += sizeof(sale);
+            }
+            offset += sizeof(sale);
+        }
+    }
+    ledger.close();
+    rebuildForecastIndex();
+
+    salesLedgerFile = fopen(SALES_LEDGER_FILE, actualSize > 0 ? "r+b" : "wb");
+    if (!salesLedgerFile) {
+        cerr << "Error opening sales ledger! Sales reports will only cover this session." << endl;
+        return;
+    }
+    // Writing from the last complete record overwrites a torn one left by a crash
+    #ifdef _WIN32
+        _fseeki64(salesLedgerFile, (__int64)salesLedgerSize, SEEK_SET);
+    #else
+        fseeko(salesLedgerFile, (off_t)salesLedgerSize, SEEK_SET);
+    #endif
+}
+
+void closeSalesLedger() {
+    lock_guard<mutex> lock(salesLedgerMutex);
+    mergePendingSales();
+    if (!salesLedgerFile) return;
+    if (fflush(salesLedgerFile) != 0 || ferror(salesLedgerFile)) reportSalesLedgerError();
+    fclose(salesLedgerFile);
+    salesLedgerFile = nullptr;
+    if (!saveSalesRollups()) cerr << "Error saving sales rollups! They will be rebuilt from the ledger." << endl;
+}
+
+// Queues each line in its product's stripe for the ledger and the rollups and
+// folds it into the product's sales rate. Only the stripe locks are taken, so
+// tills selling different products run side by side; the flusher writes the
+// queued lines out. The caller holds the store lock (and the items' stripe
+// locks), so categories and quantities are stable. A line that brings an item
+// within REORDER_LEAD_DAYS of running out raises a reorder alert, once until
+// its stock recovers.
+void recordSales(const Basket& lines) {
+    time_t now = time(0);
+    vector<ReorderLine> alerts;
+    for (const BasketLine& line : lines) {
+        SaleRecord sale = {(int64_t)now, line.productID, line.quantity, line.price};
+        int index = findItemIndexByID(line.productID);
+        string category = index >= 0 ? categoryName(stock[index].categoryID) : string("Unknown");
+        SalesStripe& stripe = salesStripe(line.productID);
+        lock_guard<mutex> lock(stripe.lock);
+        stripe.pending.push_back({sale, move(category)});
+        addToVelocity(stripe, sale);
+        if (index < 0) continue;
+
+        placeReorderKey(stripe, line.productID, stock[index].quantity);
+        SalesVelocity& velocity = stripe.velocities[line.productID];
+        if (velocity.listed && !velocity.alerted && forecastDaysLeft(velocity.key, now) < REORDER_LEAD_DAYS) {
+            velocity.alerted = true;
+            alerts.push_back(reorderLine(velocity, (size_t)index, now));
+        }
+    }
+    for (const ReorderLine& line : alerts) printReorderAlert(line);
+}
+
+// Takes every stripe's queued sales, appends them to the ledger in one write
+// and adds them to the rollups
+void mergePendingSales() {
+    vector<PendingSale> merged;
+    for (SalesStripe& stripe : salesStripes) {
+        lock_guard<mutex> lock(stripe.lock);
+        if (merged.empty()) {
+            merged.swap(stripe.pending);
+        } else {
+            merged.insert(merged.end(), make_move_iterator(stripe.pending.begin()), make_move_iterator(stripe.pending.end()));
+            stripe.pending.clear();
+        }
+    }
+    if (merged.empty()) return;
+    // Each stripe is already in time order; keep the ledger that way as a whole
+    stable_sort(merged.begin(), merged.end(), [](const PendingSale& a, const PendingSale& b) {
+        return a.sale.timestamp < b.sale.timestamp;
+    });
+
+    if (salesLedgerFile) {
+        vector<SaleRecord> records;
+        records.reserve(merged.size());
+        for (const PendingSale& pending : merged) records.push_back(pending.sale);
+        size_t written = fwrite(records.data(), sizeof(SaleRecord), records.size(), salesLedgerFile);
+        salesLedgerSize += written * sizeof(SaleRecord);
+        velocityLedgerSize += written * sizeof(SaleRecord);
+        if (written != records.size()) reportSalesLedgerError();
+    }
+    for (const PendingSale& pending : merged) addToRollups(pending.sale, pending.category);
+}
+
+// Sales keep counting in the rollups; only the ledger (and so the totals after
+// a restart) misses them. Reported once until a flush succeeds again.
+void reportSalesLedgerError() {
+    if (salesLedgerFile) clearerr(salesLedgerFile);
+    if (salesLedgerFailing) return;
+    salesLedgerFailing = true;
+    cerr << "Error writing sales ledger! Sales reports may miss sales after a restart." << endl;
+}
+
+void addToRollups(const SaleRecord& sale, const string& category) {
+    Money amount = sale.price * sale.quantity;
+    for (int period = 0; period < ROLLUP_PERIOD_COUNT; ++period) {
+        map<int64_t, SalesBucket>& buckets = salesRollups[period];
+        int64_t start = rollupBucketStart((time_t)sale.timestamp, (RollupPeriod)period);
+        auto found = buckets.find(start);
+        if (found == buckets.end()) {
+            found = buckets.emplace(start, SalesBucket()).first;
+            if (period == ROLLUP_HOURLY) {
+                int64_t cutoff = start - SALES_HOURLY_RETENTION_DAYS * 86400LL;
+                buckets.erase(buckets.begin(), buckets.lower_bound(cutoff));
+            }
+        }
+        SalesBucket& bucket = found->second;
+        for (SalesTotals* totals : {&bucket.total, &bucket.products[sale.productID], &bucket.categories[category]}) {
+            totals->lines++;
+            totals->units += sale.quantity;
+            totals->revenue += amount;
+        }
+    }
+}
+
+// Start of the local hour or day containing when. The last bucket of each
+// period is cached, since consecutive sales almost always fall in the same one
+// (caller holds salesLedgerMutex).
+int64_t rollupBucketStart(time_t when, RollupPeriod period) {
+    static int64_t cachedStart[ROLLUP_PERIOD_COUNT] = {0, 0};
+    static int64_t cachedEnd[ROLLUP_PERIOD_COUNT] = {0, 0};
+    if (when >= cachedStart[period] && when < cachedEnd[period]) return cachedStart[period];
+
+    struct tm local;
+    #ifdef _WIN32
+        localtime_s(&local, &when);
+    #else
+        localtime_r(&when, &local);
+    #endif
+    local.tm_sec = 0;
+    local.tm_min = 0;
+    if (period == ROLLUP_DAILY) local.tm_hour = 0;
+    local.tm_isdst = -1;
+    struct tm next = local;
+    if (period == ROLLUP_DAILY) next.tm_mday++;
+    else next.tm_hour++;
+    cachedStart[period] = (int64_t)mktime(&local);
+    cachedEnd[period] = (int64_t)mktime(&next);
+    return cachedStart[period];
+}
+
+// sales.rollup is a tab separated text file:
+//   SALESROLLUP  2  <ledger bytes covered>
+//   H|D  <bucket start>  T  <lines>  <units>  <revenue>             (bucket total)
+//   H|D  <bucket start>  P  <productID>  <lines>  <units>  <revenue>
+//   H|D  <bucket start>  C  <lines>  <units>  <revenue>  <category>
+//   V  <productID>  <logUnits>  [<first sale>  <sales>]             (sales rate)
+// Version 1 files have no V lines. The last two fields are only written for
+// products still warming up; a rate without them is in use.
+bool loadSalesRollups() {
+    ifstream in(SALES_ROLLUP_FILE);
+    if (!in.is_open()) return false;
+    string line;
+    if (!getline(in, line) || line.compare(0, 12, "SALESROLLUP\t") != 0) return false;
+    istringstream header(line.substr(12));
+    int version = 0;
+    uint64_t covered = 0;
+    if (!(header >> version >> covered) || version < 1 || version > 2) return false;
+
+    while (getline(in, line)) {
+        if (line.compare(0, 2, "V\t") == 0) {
+            istringstream fields(line.substr(2));
+            int productID;
+            double logUnits;
+            if (!(fields >> productID >> logUnits)) continue;
+            SalesVelocity& velocity = salesStripe(productID).velocities[productID];
+            velocity.logUnits = logUnits;
+            velocity.warm = !(fields >> velocity.firstSale >> velocity.sales);
+            continue;
+        }
+        istringstream fields(line);
+        string period, kind, revenue;
+        int64_t start;
+        SalesTotals totals;
+        int productID = 0;
+        if (!getline(fields, period, '\t') || period.size() != 1 || !(fields >> start) ||
+            !(fields.ignore() && getline(fields, kind, '\t'))) continue;
+        if (kind == "P" && !(fields >> productID)) continue;
+        if (!(fields >> totals.lines >> totals.units >> revenue)) continue;
+        try {
+            totals.revenue = toMoney(revenue);
+        } catch (...) {
+            continue;
+        }
+
+        SalesBucket& bucket = salesRollups[period == "H" ? ROLLUP_HOURLY : ROLLUP_DAILY][start];
+        if (kind == "T") {
+            bucket.total = totals;
+        } else if (kind == "P") {
+            bucket.products[productID] = totals;
+        } else if (kind == "C") {
+            string category;
+            fields.ignore();
+            getline(fields, category);
+            bucket.categories[category] = totals;
+        }
+    }
+    salesLedgerSize = covered;
+    velocityLedgerSize = version >= 2 ? covered : 0;
+    return true;
+}
+
+bool saveSalesRollups() {
+    FILE* out = openAtomicWrite(SALES_ROLLUP_FILE);
+    if (!out) return false;
+    string text = "SALESROLLUP\t2\t" + to_string(salesLedgerSize) + '\n';
+    auto appendTotals = [&text](const SalesTotals& totals) {
+        text += to_string(totals.lines) + '\t' + to_string(totals.units) + '\t';
+        appendMoney(text, totals.revenue);
+    };
+    for (int period = 0; period < ROLLUP_PERIOD_COUNT; ++period) {
+        const char* tag = period == ROLLUP_HOURLY ? "H\t" : "D\t";
+        for (const auto& entry : salesRollups[period]) {
+            string prefix = tag + to_string(entry.first) + '\t';
+            text += prefix + "T\t";
+            appendTotals(entry.second.total);
+            text += '\n';
+            for (const auto& product : entry.second.products) {
+                text += prefix + "P\t" + to_string(product.first) + '\t';
+                appendTotals(product.second);
+                text += '\n';
+            }
+            for (const auto& category : entry.second.categories) {
+                text += prefix + "C\t";
+                appendTotals(category.second);
+                text += '\t' + category.first + '\n';
+            }
+            if (text.size() >= 64 * 1024) {
+                fwrite(text.data(), 1, text.size(), out);
+                text.clear();
+            }
+        }
+    }
+    char number[32];
+    for (SalesStripe& stripe : salesStripes) {
+        lock_guard<mutex> lock(stripe.lock);
+        for (const auto& entry : stripe.velocities) {
+            const SalesVelocity& velocity = entry.second;
+            snprintf(number, sizeof(number), "%.9f", velocity.logUnits);
+            text += "V\t" + to_string(entry.first) + '\t' + number;
+            if (!velocity.warm) text += '\t' + to_string(velocity.firstSale) + '\t' + to_string(velocity.sales);
+            text += '\n';
+            if (text.size() >= 64 * 1024) {
+                fwrite(text.data(), 1, text.size(), out);
+                text.clear();
+            }
+        }
+    }
+    fwrite(text.data(), 1, text.size(), out);
+    return commitAtomicWrite(out, SALES_ROLLUP_FILE);
+}
+
+// ln(e^a + e^b) without overflowing (a or b may be -infinity)
+static double logAddExp(double a, double b) {
+    if (a == -HUGE_VAL) return b;
+    if (b == -HUGE_VAL) return a;
+    return max(a, b) + log1p(exp(-fabs(a - b)));
+}
+
+// Product IDs are spread over the stripes the same way as over itemLocks
+SalesStripe& salesStripe(int productID) {
+    return salesStripes[(uint32_t)productID % SALES_STRIPES];
+}
+
+void addToVelocity(SalesStripe& stripe, const SaleRecord& sale) {
+    if (sale.quantity <= 0) return;
+    SalesVelocity& velocity = stripe.velocities[sale.productID];
+    double units = log((double)sale.quantity) + sale.timestamp / SALES_VELOCITY_SECONDS;
+    velocity.logUnits = logAddExp(velocity.logUnits, units);
+    if (velocity.warm) return;
+
+    if (velocity.sales++ == 0) velocity.firstSale = sale.timestamp;
+    double observed = (double)(sale.timestamp - velocity.firstSale);
+    if (velocity.sales >= (uint32_t)REORDER_WARMUP_SALES && observed >= REORDER_WARMUP_DAYS * 86400.0) {
+        // The average covers only `observed` of its time constant: divide by
+        // 1 - e^(-observed/tau) so it reads as if that rate had held all along
+        velocity.logUnits -= log(-expm1(-observed / SALES_VELOCITY_SECONDS));
+        velocity.warm = true;
+    }
+}
+
+// Moves a product to its place for this quantity (an empty shelf sorts first).
+// Products that have never sold, or are still warming up, are not listed.
+void placeReorderKey(SalesStripe& stripe, int productID, int quantity) {
+    auto found = stripe.velocities.find(productID);
+    if (found == stripe.velocities.end() || !found->second.warm) return;
+    SalesVelocity& velocity = found->second;
+    if (velocity.listed) stripe.reorderOrder.erase(make_pair(velocity.key, productID));
+    velocity.key = quantity > 0 ? log((double)quantity) - velocity.logUnits : -HUGE_VAL;
+    velocity.listed = true;
+    stripe.reorderOrder.emplace(velocity.key, productID);
+    if (forecastDaysLeft(velocity.key, time(0)) >= REORDER_LEAD_DAYS) velocity.alerted = false;
+}
+
+void updateForecast(int productID, int quantity) {
+    SalesStripe& stripe = salesStripe(productID);
+    lock_guard<mutex> lock(stripe.lock);
+    placeReorderKey(stripe, productID, quantity);
+}
+
+void dropForecast(int productID) {
+    SalesStripe& stripe = salesStripe(productID);
+    lock_guard<mutex> lock(stripe.lock);
+    auto found = stripe.velocities.find(productID);
+    if (found == stripe.velocities.end()) return;
+    if (found->second.listed) stripe.reorderOrder.erase(make_pair(found->second.key, productID));
+    stripe.velocities.erase(found);
+}
+
+// The two IDs usually live in different stripes; each lock is held on its own
+void moveForecast(int oldID, int newID, int quantity) {
+    SalesVelocity velocity;
+    {
+        SalesStripe& stripe = salesStripe(oldID);
+        lock_guard<mutex> lock(stripe.lock);
+        auto found = stripe.velocities.find(oldID);
+        if (found == stripe.velocities.end()) return;
+        velocity = found->second;
+        if (velocity.listed) stripe.reorderOrder.erase(make_pair(velocity.key, oldID));
+        stripe.velocities.erase(found);
+    }
+    SalesStripe& stripe = salesStripe(newID);
+    lock_guard<mutex> lock(stripe.lock);
+    auto previous = stripe.velocities.find(newID);
+    if (previous != stripe.velocities.end() && previous->second.listed) {
+        stripe.reorderOrder.erase(make_pair(previous->second.key, newID));
+    }
+    velocity.listed = false;
+    stripe.velocities[newID] = velocity;
+    placeReorderKey(stripe, newID, quantity);
+}
+
+// Every item in stock that has sold is placed from its column quantity
+void rebuildForecastIndex() {
+    bool anySold = false;
+    for (SalesStripe& stripe : salesStripes) {
+        lock_guard<mutex> lock(stripe.lock);
+        stripe.reorderOrder.clear();
+        for (auto& entry : stripe.velocities) entry.second.listed = false;
+        anySold = anySold || !stripe.velocities.empty();
+    }
+    if (!anySold) return;
+    for (size_t i = 0; i < colProductID.size(); ++i) {
+        SalesStripe& stripe = salesStripe(colProductID[i]);
+        lock_guard<mutex> lock(stripe.lock);
+        placeReorderKey(stripe, colProductID[i], colQuantity[i]);
+    }
+}
+
+// rate = e^(logUnits - now/tau) / tau, in units per day
+double forecastPerDay(const SalesVelocity& velocity, time_t now) {
+    return exp(velocity.logUnits - now / SALES_VELOCITY_SECONDS) / SALES_VELOCITY_DAYS;
+}
+
+double forecastDaysLeft(double key, time_t now) {
+    return exp(key + now / SALES_VELOCITY_SECONDS) * SALES_VELOCITY_DAYS;
+}
+
+// One line of the forecast for stock[index] (caller holds the stripe lock and the store lock)
+ReorderLine reorderLine(const SalesVelocity& velocity, size_t index, time_t now) {
+    const StockItem& item = stock[index];
+    ReorderLine line;
+    line.productID = item.productID;
+    line.name = item.name;
+    line.quantity = item.quantity;
+    line.perDay = forecastPerDay(velocity, now);
+    line.daysLeft = item.quantity > 0 ? forecastDaysLeft(velocity.key, now) : 0;
+    double wanted = round(line.perDay * REORDER_COVER_DAYS) - max(0, item.quantity);
+    line.suggested = (int)min(max(0.0, wanted), (double)numeric_limits<int>::max());
+    return line;
+}
+
+// Walks each stripe's reorderOrder from the front and merges the lines: O(log n + k)
+// for k items, no history read
+vector<ReorderLine> reorderForecast(int days) {
+    vector<ReorderLine> lines;
+    time_t now = time(0);
+    for (SalesStripe& stripe : salesStripes) {
+        lock_guard<mutex> lock(stripe.lock);
+        for (const auto& entry : stripe.reorderOrder) {
+            if (forecastDaysLeft(entry.first, now) >= days) break;
+            int index = findItemIndexByID(entry.second);
+            if (index >= 0) lines.push_back(reorderLine(stripe.velocities[entry.second], (size_t)index, now));
+        }
+    }
+    // Empty shelves (daysLeft 0) first, as in reorderOrder
+    stable_sort(lines.begin(), lines.end(), [](const ReorderLine& a, const ReorderLine& b) {
+        if ((a.quantity > 0) != (b.quantity > 0)) return a.quantity <= 0;
+        return a.daysLeft < b.daysLeft;
+    });
+    return lines;
+}
+
+void printReorderAlert(const ReorderLine& line) {
+    char daysLeft[32];
+    snprintf(daysLeft, sizeof(daysLeft), "%.1f", line.daysLeft);
+    if (interactive) {
+        cout << "\n*** REORDER: " << line.name << " has about " << daysLeft << " days of stock left ("
+             << line.quantity << " units, suggested order " << line.suggested << ") ***" << endl;
+    }
+    if (Inventory::countBatchAlert(Inventory::ALERT_REORDER)) return;
+    logAction(ACTION_OTHER, line.productID, line.quantity, 0,
+              "REORDER ALERT: " + line.name + " (ID: " + to_string(line.productID) + ", " + daysLeft +
+              " days left, order " + to_string(line.suggested) + ")");
+}
+
+// Logs an action that has no item attached (startup, exit, imports...)
+void logAction(const string& action) {
+    logAction(ACTION_OTHER, 0, 0, 0, action);
+}
+
+// Logs an action to the history and memory. The line is only queued here;
+// the logger thread writes it to history.log with the next batch.
+void logAction(ActionType type, int productID, int quantity, Money price, const string& action) {
+    MetricTimer timer(METRIC_LOG_ACTION);
+    time_t now = time(0);
+    string line = "[" + formatTimestamp(now) + "] " + action;
+    recordHistory(now, type, productID, quantity, price, action);
+
+    if (!loggerRunning) {
+        // Logger not started (or already stopped): write the line directly
+        ofstream historyFile(HISTORY_FILE, ios::app);
+        if (historyFile.is_open()) historyFile << line << '\n';
+        return;
+    }
+
+    while (!enqueueLogLine(line)) {
+        // Queue full: wake the logger (the flag makes the wake count, instead of
+        // waiting out the flush interval) and give it a moment to drain
+        countEvent(COUNTER_LOG_QUEUE_FULL);
+        logDrainRequested.store(true);
+        loggerWake.notify_one();
+        this_thread::yield();
+    }
+}
+
+// Formats a timestamp like ctime() without the trailing newline. The last
+// formatted second is cached per thread, so most calls are just a copy.
+string formatTimestamp(time_t when) {
+    thread_local time_t cachedSecond = -1;
+    thread_local string cachedText;
+    if (when != cachedSecond) {
+        struct tm local;
+        #ifdef _WIN32
+            localtime_s(&local, &when);
+        #else
+            localtime_r(&when, &local);
+        #endif
+        char buffer[32];
+        strftime(buffer, sizeof(buffer), "%a %b %e %H:%M:%S %Y", &local);
+        cachedText = buffer;
+        cachedSecond = when;
+    }
+    return cachedText;
+}
+
+// Stores a structured record in the ring, overwriting the oldest one when full
+void recordHistory(time_t when, ActionType type, int productID, int quantity, Money price, const string& text) {
+    lock_guard<mutex> lock(historyRingMutex);
+    HistoryRecord& record = historyRing[historyRingNext];
+    record.timestamp = when;
+    record.type = type;
+    record.productID = productID;
+    record.quantity = quantity;
+    record.price = price;
+    size_t length = min(text.size(), sizeof(record.text) - 1);
+    memcpy(record.text, text.data(), length);
+    record.text[length] = '\0';
+
+    historyRingNext = (historyRingNext + 1) % HISTORY_RING_CAPACITY;
+    if (historyRingCount < HISTORY_RING_CAPACITY) historyRingCount++;
+}
+
+// Same keyword rules the history summary has always used. The logger and the
+// catch-up in loadHistoryIndex() both count lines through this.
+ActionType classifyLogLine(const string& line) {
+    if (line.find("SALE:") != string::npos) return ACTION_SALE;
+    if (line.find("RESTOCK:") != string::npos) return ACTION_RESTOCK;
+    if (line.find("Added") != string::npos || line.find("NEW ITEM") != string::npos) return ACTION_ADD;
+    if (line.find("Updated") != string::npos || line.find("UPDATE") != string::npos) return ACTION_UPDATE;
+    if (line.find("Deleted") != string::npos || line.find("DELETE") != string::npos) return ACTION_DELETE;
+    return ACTION_OTHER;
+}
+
+// Seeds the ring with the last lines of history.log by seeking straight to the
+// oldest offset kept in the tail index, so earlier sessions show up too. Right
+// after a rotation the log holds only a few lines; the rest come from the end
+// of the newest archived segment.
+void loadRecentHistory() {
+    uint64_t start = 0, newestSegment = 0;
+    size_t tailCount;
+    {
+        lock_guard<mutex> lock(historyIndexMutex);
+        tailCount = historyIndex.tailCount;
+        if (tailCount > 0) {
+            size_t oldest = (historyIndex.tailNext + HISTORY_RECENT_COUNT - tailCount) % HISTORY_RECENT_COUNT;
+            start = historyIndex.tailOffsets[oldest];
+        }
+        if (historyIndex.nextSegment > historyIndex.firstSegment) newestSegment = historyIndex.nextSegment - 1;
+    }
+
+    auto replay = [](istream& lines) {
+        string entry;
+        while (getline(lines, entry)) {
+            // Lines look like "[Wed Oct 14 17:19:21 2026] message"
+            size_t close = entry.find("] ");
+            if (entry.empty() || entry[0] != '[' || close == string::npos) continue;
+
+            struct tm parsed = {};
+            istringstream stamp(entry.substr(1, close - 1));
+            stamp >> get_time(&parsed, "%a %b %d %H:%M:%S %Y");
+            parsed.tm_isdst = -1;
+            time_t when = stamp.fail() ? 0 : mktime(&parsed);
+
+            recordHistory(when, classifyLogLine(entry), 0, 0, 0, entry.substr(close + 2));
+        }
+    };
+
+    string archived;
+    if (tailCount < HISTORY_RECENT_COUNT && newestSegment > 0 && readHistorySegment(newestSegment, archived)) {
+        // Walk back over the last lines the current log cannot provide
+        size_t begin = archived.size();
+        for (size_t lines = tailCount; begin > 0 && lines < HISTORY_RECENT_COUNT; ++lines) {
+            size_t newline = begin >= 2 ? archived.rfind('\n', begin - 2) : string::npos;
+            begin = newline == string::npos ? 0 : newline + 1;
+        }
+        istringstream recent(archived.substr(begin));
+        replay(recent);
+    }
+    if (tailCount == 0) return;
+
+    ifstream historyFile(HISTORY_FILE, ios::binary);
+    if (!historyFile.is_open()) return;
+    historyFile.seekg((streamoff)start);
+    replay(historyFile);
+}
+
+// Adds one line (starting at offset) to the running counters and the tail ring.
+// Caller holds historyIndexMutex.
+void indexHistoryLine(uint64_t offset, size_t length, ActionType type) {
+    historyIndex.totalCount++;
+    historyIndex.typeCounts[type]++;
+    historyIndex.tailOffsets[historyIndex.tailNext] = offset;
+    historyIndex.tailNext = (historyIndex.tailNext + 1) % HISTORY_RECENT_COUNT;
+    if (historyIndex.tailCount < HISTORY_RECENT_COUNT) historyIndex.tailCount++;
+    historyIndex.logSize = offset + length + 1;
+}
+
+// Loads history.idx and verifies it against the log. If the log has grown past
+// the indexed size (e.g. a crash before the index was saved) only the new part
+// is scanned; if it shrank or there is no index, the log is indexed from scratch.
+void loadHistoryIndex() {
+    lock_guard<mutex> lock(historyIndexMutex);
+    historyIndex = HistoryIndex();
+    historyIndex.firstSegment = historyIndex.nextSegment = 1;
+    historyIndex.logStarted = (int64_t)time(0);
+
+    ifstream historyFile(HISTORY_FILE, ios::binary | ios::ate);
+    uint64_t actualSize = historyFile.is_open() ? (uint64_t)historyFile.tellg() : 0;
+
+    ifstream indexFile(HISTORY_INDEX_FILE);
+    if (indexFile.is_open()) {
+        HistoryIndex loaded = {};
+        bool ok = (bool)(indexFile >> loaded.logSize >> loaded.totalCount);
+        for (int t = 0; ok && t < ACTION_TYPE_COUNT; ++t) ok = (bool)(indexFile >> loaded.typeCounts[t]);
+        ok = ok && (indexFile >> loaded.tailCount) && loaded.tailCount <= HISTORY_RECENT_COUNT;
+        for (size_t i = 0; ok && i < loaded.tailCount; ++i) ok = (bool)(indexFile >> loaded.tailOffsets[i]);
+        loaded.tailNext = loaded.tailCount % HISTORY_RECENT_COUNT;
+        // Indexes written before rotation existed end here
+        if (ok && !(indexFile >> loaded.firstSegment >> loaded.nextSegment >> loaded.logStarted >> loaded.archivedBytes)) {
+            loaded.firstSegment = loaded.nextSegment = 1;
+            loaded.logStarted = historyIndex.logStarted;
+            loaded.archivedBytes = 0;
+        }
+        if (ok && loaded.logSize > actualSize) {
+            // A crash between renaming the log and saving the index: finish the rotation
+            ifstream rotated(historySegmentPath(loaded.nextSegment, false), ios::binary | ios::ate);
+            if (rotated.is_open() && (uint64_t)rotated.tellg() == loaded.logSize) {
+                loaded.nextSegment++;
+                loaded.logSize = 0;
+                loaded.tailCount = loaded.tailNext = 0;
+                loaded.logStarted = historyIndex.logStarted;
+            }
+        }
+        if (ok && loaded.logSize <= actualSize) {
+            historyIndex = loaded;
+        } else if (ok) {
+            // The log was replaced: recount it, but keep track of the archived segments
+            historyIndex.firstSegment = loaded.firstSegment;
+            historyIndex.nextSegment = loaded.nextSegment;
+            historyIndex.archivedBytes = loaded.archivedBytes;
+        }
+    }
+
+    if (!historyFile.is_open() || historyIndex.logSize == actualSize) return;
+
+    // Catch up on lines appended after the index was last written
+    historyFile.seekg((streamoff)historyIndex.logSize);
+    uint64_t offset = historyIndex.logSize;
+    string line;
+    while (getline(historyFile, line)) {
+        indexHistoryLine(offset, line.size(), classifyLogLine(line));
+        offset += line.size() + 1;
+    }
+    historyIndex.logSize = actualSize;
+    indexFile.close();
+    saveHistoryIndex();
+}
+
+// Writes the counters and tail offsets to history.idx (caller holds historyIndexMutex)
+void saveHistoryIndex() {
+    ofstream out(HISTORY_INDEX_FILE, ios::trunc);
+    if (!out.is_open()) return;
+    out << historyIndex.logSize << ' ' << historyIndex.totalCount;
+    for (int t = 0; t < ACTION_TYPE_COUNT; ++t) out << ' ' << historyIndex.typeCounts[t];
+    size_t oldest = (historyIndex.tailNext + HISTORY_RECENT_COUNT - historyIndex.tailCount) % HISTORY_RECENT_COUNT;
+    out << '\n' << historyIndex.tailCount;
+    for (size_t i = 0; i < historyIndex.tailCount; ++i) {
+        out << ' ' << historyIndex.tailOffsets[(oldest + i) % HISTORY_RECENT_COUNT];
+    }
+    out << '\n' << historyIndex.firstSegment << ' ' << historyIndex.nextSegment << ' '
+        << historyIndex.logStarted << ' ' << historyIndex.archivedBytes << '\n';
+}
+
+string historySegmentPath(uint64_t segment, bool compressed) {
+    char name[48];
+    snprintf(name, sizeof(name), "history.%05llu.log%s", (unsigned long long)segment, compressed ? ".lz4" : "");
+    return name;
+}
+
+// Starts a new history.log once the current one has reached historyRotateBytes
+// or HISTORY_ROTATE_SECONDS. Runs on the logger thread between batches, so a
+// line never straddles two segments. The index is saved right after the rename;
+// loadHistoryIndex() finishes the job if a crash comes in between.
+void rotateHistoryIfDue(FILE*& historyFile) {
+    uint64_t segment;
+    {
+        lock_guard<mutex> lock(historyIndexMutex);
+        if (historyIndex.logSize == 0) return;
+        bool big = historyRotateBytes > 0 && historyIndex.logSize >= historyRotateBytes;
+        bool old = (int64_t)time(0) - historyIndex.logStarted >= HISTORY_ROTATE_SECONDS;
+        if (!big && !old) return;
+        segment = historyIndex.nextSegment;
+    }
+
+    if (historyFile) fclose(historyFile);
+    bool rotated = rename(HISTORY_FILE, historySegmentPath(segment, false).c_str()) == 0;
+    {
+        lock_guard<mutex> lock(historyIndexMutex);
+        if (rotated) {
+            historyIndex.nextSegment++;
+            historyIndex.logSize = 0;
+            historyIndex.tailCount = historyIndex.tailNext = 0;
+        }
+        historyIndex.logStarted = (int64_t)time(0); // After a failed rename, try again next period
+        saveHistoryIndex();
+    }
+    historyFile = fopen(HISTORY_FILE, "a");
+    if (rotated) startHistoryCompression();
+}
+
+// Hands the rotated segments to the compressor thread. If a round is still
+// running it picks them up when it is done, so the logger thread never waits
+// for a compression; otherwise a new thread is started (the previous one has
+// already left its loop, so joining it does not block).
+void startHistoryCompression() {
+    lock_guard<mutex> lock(historyCompressorMutex);
+    historyCompressionPending = true;
+    if (historyCompressorRunning) return;
+    if (historyCompressor.joinable()) historyCompressor.join();
+    historyCompressorRunning = true;
+    historyCompressor = thread(historyCompressorMain);
+}
+
+void historyCompressorMain() {
+    unique_lock<mutex> lock(historyCompressorMutex);
+    while (historyCompressionPending) {
+        historyCompressionPending = false;
+        lock.unlock();
+        compressHistorySegments();
+        lock.lock();
+    }
+    historyCompressorRunning = false;
+}
+
+// Compresses every segment still stored as plain text, then deletes the oldest
+// archives beyond HISTORY_KEEP_SEGMENTS. Each archive is written atomically and
+// only then is the plain segment removed, so a crash leaves one or the other.
+void compressHistorySegments() {
+    uint64_t first, next;
+    {
+        lock_guard<mutex> lock(historyIndexMutex);
+        first = historyIndex.firstSegment;
+        next = historyIndex.nextSegment;
+    }
+
+    for (uint64_t segment = first; segment < next; ++segment) {
+        string plainPath = historySegmentPath(segment, false);
+        string archivePath = historySegmentPath(segment, true);
+        ifstream plain(plainPath, ios::binary);
+        if (!plain.is_open()) continue;
+        if (ifstream(archivePath, ios::binary).is_open()) {
+            // Compressed before a crash, but the plain copy was never removed
+            plain.close();
+            remove(plainPath.c_str());
+            continue;
+        }
+        ostringstream text;
+        text << plain.rdbuf();
+        plain.close();
+
+        string frame;
+        lz4CompressFrame(text.str(), frame);
+        FILE* file = openAtomicWrite(archivePath);
+        if (!file) continue;
+        fwrite(frame.data(), 1, frame.size(), file);
+        if (!commitAtomicWrite(file, archivePath)) continue;
+        remove(plainPath.c_str());
+
+        lock_guard<mutex> lock(historyIndexMutex);
+        historyIndex.archivedBytes += frame.size();
+        saveHistoryIndex();
+    }
+
+    lock_guard<mutex> lock(historyIndexMutex);
+    bool dropped = false;
+    while (historyIndex.nextSegment - historyIndex.firstSegment > HISTORY_KEEP_SEGMENTS) {
+        string archivePath = historySegmentPath(historyIndex.firstSegment, true);
+        ifstream archive(archivePath, ios::binary | ios::ate);
+        uint64_t bytes = archive.is_open() ? (uint64_t)archive.tellg() : 0;
+        archive.close();
+        remove(archivePath.c_str());
+        remove(historySegmentPath(historyIndex.firstSegment, false).c_str());
+        historyIndex.archivedBytes -= min(bytes, historyIndex.archivedBytes);
+        historyIndex.firstSegment++;
+        dropped = true;
+    }
+    if (dropped) saveHistoryIndex();
+}
+
+// Reads an archived segment back, from its .lz4 archive or (not yet
+// compressed) the plain file
+bool readHistorySegment(uint64_t segment, string& text) {
+    ifstream archive(historySegmentPath(segment, true), ios::binary);
+    if (archive.is_open()) {
+        ostringstream frame;
+        frame << archive.rdbuf();
+        return lz4DecompressFrame(frame.str(), text);
+    }
+    ifstream plain(historySegmentPath(segment, false), ios::binary);
+    if (!plain.is_open()) return false;
+    ostringstream contents;
+    contents << plain.rdbuf();
+    text = contents.str();
+    return true;
+}
+
+// xxHash32, as the LZ4 frame format uses for its header and content checksums
+uint32_t xxHash32(const void* data, size_t length, uint32_t seed) {
+    const uint32_t PRIME1 = 2654435761U, PRIME2 = 2246822519U, PRIME3 = 3266489917U;
+    const uint32_t PRIME4 = 668265263U, PRIME5 = 374761393U;
+    auto rotl = [](uint32_t x, int r) { return (x << r) | (x >> (32 - r)); };
+    auto read32 = [](const unsigned char* p) { uint32_t v; memcpy(&v, p, 4); return v; }; // Little endian, like the snapshot
+
+    const unsigned char* p = (const unsigned char*)data;
+    const unsigned char* end = p + length;
+    uint32_t hash;
+    if (length >= 16) {
+        uint32_t v1 = seed + PRIME1 + PRIME2, v2 = seed + PRIME2, v3 = seed, v4 = seed - PRIME1;
+        for (; p + 16 <= end; p += 16) {
+            v1 = rotl(v1 + read32(p) * PRIME2, 13) * PRIME1;
+            v2 = rotl(v2 + read32(p + 4) * PRIME2, 13) * PRIME1;
+            v3 = rotl(v3 + read32(p + 8) * PRIME2, 13) * PRIME1;
+            v4 = rotl(v4 + read32(p + 12) * PRIME2, 13) * PRIME1;
+        }
+        hash = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+    } else {
+        hash = seed + PRIME5;
+    }
+    hash += (uint32_t)length;
+    for (; p + 4 <= end; p += 4) hash = rotl(hash + read32(p) * PRIME3, 17) * PRIME4;
+    for (; p < end; ++p) hash = rotl(hash + *p * PRIME5, 11) * PRIME1;
+    hash ^= hash >> 15;
+    hash *= PRIME2;
+    hash ^= hash >> 13;
+    hash *= PRIME3;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+// LZ4 length fields: 15 in the token, then bytes of 255 and a final remainder
+static void appendLz4Length(string& out, size_t length) {
+    for (; length >= 255; length -= 255) out += (char)255;
+    out += (char)length;
+}
+
+// Appends data as one LZ4 block: a greedy single-probe match finder over a
+// 64K-entry hash table of 4-byte sequences. Follows the block format rules
+// (the last 5 bytes are literals, no match starts within 12 bytes of the end).
+void lz4CompressBlock(const char* data, size_t length, string& out) {
+    const size_t MIN_MATCH = 4, LAST_LITERALS = 5, MATCH_LIMIT = 12, HASH_BITS = 16;
+    vector<uint32_t> table((size_t)1 << HASH_BITS, UINT32_MAX);
+    size_t anchor = 0, pos = 0;
+
+    auto appendSequence = [&](size_t literals, size_t offset, size_t matchLength) {
+        size_t extraMatch = matchLength >= MIN_MATCH ? matchLength - MIN_MATCH : 0;
+        out += (char)((min(literals, (size_t)15) << 4) | (matchLength ? min(extraMatch, (size_t)15) : 0));
+        if (literals >= 15) appendLz4Length(out, literals - 15);
+        out.append(data + anchor, literals);
+        if (matchLength == 0) return; // The last sequence has literals only
+        out += (char)(offset & 0xFF);
+        out += (char)(offset >> 8);
+        if (extraMatch >= 15) appendLz4Length(out, extraMatch - 15);
+    };
+
+    if (length > MATCH_LIMIT) {
+        for (size_t limit = length - MATCH_LIMIT; pos < limit;) {
+            uint32_t sequence;
+            memcpy(&sequence, data + pos, 4);
+            uint32_t slot = (sequence * 2654435761U) >> (32 - HASH_BITS);
+            uint32_t candidate = table[slot];
+            table[slot] = (uint32_t)pos;
+            if (candidate == UINT32_MAX || pos - candidate > 65535 || memcmp(data + candidate, data + pos, MIN_MATCH) != 0) {
+                pos++;
+                continue;
+            }
+            size_t matchLength = MIN_MATCH, longest = length - LAST_LITERALS - pos;
+            while (matchLength < longest && data[candidate + matchLength] == data[pos + matchLength]) matchLength++;
+            appendSequence(pos - anchor, pos - candidate, matchLength);
+            pos += matchLength;
+            anchor = pos;
+        }
+    }
+    appendSequence(length - anchor, 0, 0);
+}
+
+// Decodes one independent LZ4 block, appending it to out
+bool lz4DecompressBlock(const unsigned char* data, size_t length, string& out) {
+    size_t blockStart = out.size(), i = 0;
+    auto readLength = [&](size_t& value) {
+        unsigned char byte;
+        do {
+            if (i >= length) return false;
+            byte = data[i++];
+            value += byte;
+        } while (byte == 255);
+        return true;
+    };
+    while (i < length) {
+        unsigned char token = data[i++];
+        size_t literals = token >> 4;
+        if (literals == 15 && !readLength(literals)) return false;
+        if (literals > length - i) return false;
+        out.append((const char*)data + i, literals);
+        i += literals;
+        if (i == length) return true; // Last sequence
+
+        if (length - i < 2) return false;
+        size_t offset = data[i] | ((size_t)data[i + 1] << 8);
+        i += 2;
+        size_t matchLength = token & 15;
+        if (matchLength == 15 && !readLength(matchLength)) return false;
+        matchLength += 4;
+        if (offset == 0 || offset > out.size() - blockStart) return false;
+        // Byte by byte: a match may overlap the bytes it produces
+        size_t from = out.size() - offset;
+        out.reserve(out.size() + matchLength);
+        for (size_t k = 0; k < matchLength; ++k) out += out[from + k];
+    }
+    return true;
+}
+
+// Writes text as an LZ4 frame: independent 4 MB blocks (stored raw when they do
+// not shrink) and an xxHash32 content checksum
+void lz4CompressFrame(const string& text, string& out) {
+    const unsigned char descriptor[2] = {0x64, 0x70}; // Version 1, independent blocks, content checksum; 4 MB blocks
+    auto append32 = [&out](uint32_t value) {
+        for (int shift = 0; shift < 32; shift += 8) out += (char)((value >> shift) & 0xFF);
+    };
+    out.clear();
+    append32(0x184D2204);
+    out.append((const char*)descriptor, 2);
+    out += (char)((xxHash32(descriptor, 2, 0) >> 8) & 0xFF);
+
+    string block;
+    for (size_t first = 0; first < text.size(); first += LZ4_BLOCK_BYTES) {
+        size_t size = min(LZ4_BLOCK_BYTES, text.size() - first);
+        block.clear();
+        lz4CompressBlock(text.data() + first, size, block);
+        if (block.size() < size) {
+            append32((uint32_t)block.size());
+            out += block;
+        } else {
+            append32((uint32_t)size | 0x80000000U);
+            out.append(text, first, size);
+        }
+    }
+    append32(0); // End mark
+    append32(xxHash32(text.data(), text.size(), 0));
+}
+
+// Reads an LZ4 frame with independent blocks (optional content size, block and
+// content checksums are understood; checksums are verified for the content)
+bool lz4DecompressFrame(const string& frame, string& text) {
+    const unsigned char* data = (const unsigned char*)frame.data();
+    size_t size = frame.size(), i = 7;
+    auto read32 = [&](size_t at) { uint32_t v; memcpy(&v, data + at, 4); return v; };
+    if (size < 7 || read32(0) != 0x184D2204) return false;
+    unsigned char flags = data[4];
+    if ((flags >> 6) != 1 || !(flags & 0x20)) return false; // Linked blocks are not supported
+    size_t headerEnd = 6 + ((flags & 0x08) ? 8 : 0) + ((flags & 0x01) ? 4 : 0);
+    if (size < headerEnd + 1 || data[headerEnd] != ((xxHash32(data + 4, headerEnd - 4, 0) >> 8) & 0xFF)) return false;
+    i = headerEnd + 1;
+
+    text.clear();
+    for (;;) {
+        if (size - i < 4) return false;
+        uint32_t blockSize = read32(i);
+        i += 4;
+        if (blockSize == 0) break;
+        bool raw = (blockSize & 0x80000000U) != 0;
+        blockSize &= 0x7FFFFFFFU;
+        if (size - i < blockSize) return false;
+        if (raw) {
+            text.append((const char*)data + i, blockSize);
+        } else if (!lz4DecompressBlock(data + i, blockSize, text)) {
+            return false;
+        }
+        i += blockSize + ((flags & 0x10) ? 4 : 0);
+        if (i > size) return false;
+    }
+    if (flags & 0x04) {
+        if (size - i < 4 || read32(i) != xxHash32(text.data(), text.size(), 0)) return false;
+    }
+    return true;
+}
+
+// Pushes a line into the bounded multi-producer queue without taking a lock
+bool enqueueLogLine(string& line) {
+    size_t pos = logEnqueuePos.load(memory_order_relaxed);
+    LogSlot* slot;
+    for (;;) {
+        slot = &logQueue[pos & (LOG_QUEUE_CAPACITY - 1)];
+        size_t seq = slot->sequence.load(memory_order_acquire);
+        long diff = (long)seq - (long)pos;
+        if (diff == 0) {
+            if (logEnqueuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) break;
+        } else if (diff < 0) {
+            return false; // Full
+        } else {
+            pos = logEnqueuePos.load(memory_order_relaxed);
+        }
+    }
+    slot->line = std::move(line);
+    slot->sequence.store(pos + 1, memory_order_release);
+    return true;
+}
+
+// Pops the oldest line; only the logger thread calls this
+bool dequeueLogLine(string& line) {
+    size_t pos = logDequeuePos.load(memory_order_relaxed);
+    LogSlot& slot = logQueue[pos & (LOG_QUEUE_CAPACITY - 1)];
+    if (slot.sequence.load(memory_order_acquire) != pos + 1) return false; // Empty
+    line = std::move(slot.line);
+    slot.sequence.store(pos + LOG_QUEUE_CAPACITY, memory_order_release);
+    logDequeuePos.store(pos + 1, memory_order_relaxed);
+    return true;
+}
+
+// Starts the logger thread (must run before the first logAction that should be batched)
+void startLogger() {
+    if (loggerRunning) return;
+    loadHistoryIndex();
+    if (historyIndex.nextSegment > historyIndex.firstSegment) startHistoryCompression(); // Leftovers from a crash, retention
+    for (size_t i = 0; i < LOG_QUEUE_CAPACITY; ++i) {
+        logQueue[i].sequence.store(i, memory_order_relaxed);
+    }
+    logEnqueuePos = 0;
+    logDequeuePos = 0;
+    loggerRunning = true;
+    loggerThread = thread(loggerThreadMain);
+}
+
+// Writes everything still queued and joins the logger thread
+void stopLogger() {
+    if (!loggerRunning) return;
+    {
+        lock_guard<mutex> lock(loggerMutex);
+        loggerRunning = false;
+    }
+    loggerWake.notify_one();
+    loggerThread.join();
+    if (historyCompressor.joinable()) historyCompressor.join();
+}
+
+// Waits until every line queued so far has been written to history.log
+void flushLogger() {
+    if (!loggerRunning) return;
+    unique_lock<mutex> lock(loggerMutex);
+    long ticket = ++logFlushRequested;
+    loggerWake.notify_one();
+    loggerFlushed.wait(lock, [&] { return logFlushCompleted >= ticket || !loggerRunning; });
+}
+
+// Drains the queue into one buffer, appends it with a single write and
+// updates the history index for the appended lines. Lines are classified from
+// their text, exactly as loadHistoryIndex() does when it catches up after a
+// crash, so the counters never depend on which of the two indexed a line.
+void writeLogBatch(FILE* historyFile, string& batch, vector<pair<size_t, ActionType>>& batchLines) {
+    string line;
+    while (dequeueLogLine(line)) {
+        batchLines.emplace_back(line.size(), classifyLogLine(line));
+        batch += line;
+        batch += '\n';
+    }
+    if (!historyFile) {
+        batch.clear();
+        batchLines.clear();
+        return;
+    }
+    if (batch.empty()) return;
+
+    fwrite(batch.data(), 1, batch.size(), historyFile);
+    fflush(historyFile);
+
+    lock_guard<mutex> lock(historyIndexMutex);
+    for (const auto& entry : batchLines) {
+        indexHistoryLine(historyIndex.logSize, entry.first, entry.second);
+    }
+    saveHistoryIndex();
+    batch.clear();
+    batchLines.clear();
+}
+
+// Logger thread: every flush interval (or when woken) drain the queue into one
+// buffer and append it with a single write
+void loggerThreadMain() {
+    FILE* historyFile = fopen(HISTORY_FILE, "a");
+    string batch;
+    vector<pair<size_t, ActionType>> batchLines;
+    batch.reserve(64 * 1024);
+
+    for (;;) {
+        long flushTicket;
+        bool running;
+        {
+            unique_lock<mutex> lock(loggerMutex);
+            loggerWake.wait_for(lock, chrono::milliseconds(logFlushIntervalMs), [] {
+                return !loggerRunning || logFlushRequested > logFlushCompleted || logDrainRequested.load();
+            });
+            logDrainRequested.store(false);
+            flushTicket = logFlushRequested;
+            running = loggerRunning;
+        }
+
+        writeLogBatch(historyFile, batch, batchLines);
+        rotateHistoryIfDue(historyFile);
+
+        {
+            lock_guard<mutex> lock(loggerMutex);
+            logFlushCompleted = flushTicket;
+        }
+        loggerFlushed.notify_all();
+
+        if (!running) break;
+    }
+
+    // Producers may still have raced a final line in after the stop request
+    writeLogBatch(historyFile, batch, batchLines);
+    if (historyFile) fclose(historyFile);
+}
+
+// Sells qty units of stock[index] at price each and adds the amount to the revenue
+OpResult applySale(size_t index, int qty, Money price) {
+    if (index >= stock.size()) return OP_NOT_FOUND;
+    StockItem& item = stock.edit(index);
+    if (qty <= 0) return OP_INVALID_QUANTITY;
+    if (qty > item.quantity) return OP_INSUFFICIENT_STOCK;
+    if (price < 0) return OP_INVALID_PRICE;
+
+    int previousQuantity = item.quantity;
+    applySaleChange(index, qty, price);
+    journalSale(item.productID, qty, price);
+    checkLowStock(index, previousQuantity);
+    return OP_OK;
+}
+
+// The state change of a sale, shared by applySale, basket checkout and replay
+void applySaleChange(size_t index, int qty, Money price) {
+    StockItem& item = stock.edit(index);
+    addRevenue(price * qty);
+    item.quantity -= qty;
+    item.lastPrice = price;
+    syncColumns(index, true);
+}
+
+// Checks a whole basket before any of it is applied. Lines for the same item
+// are added up, so together they can never sell more than is in stock.
+OpResult validateBasket(const Basket& basket, size_t* failedLine) {
+    if (basket.empty()) return OP_EMPTY_BASKET;
+    unordered_map<int, int> requested; // productID -> units across all lines
+    for (size_t i = 0; i < basket.size(); ++i) {
+        const BasketLine& line = basket[i];
+        OpResult result = OP_OK;
+        int index = findItemIndexByID(line.productID);
+        if (index < 0) {
+            result = OP_NOT_FOUND;
+        } else if (line.quantity <= 0) {
+            result = OP_INVALID_QUANTITY;
+        } else if (line.price < 0) {
+            result = OP_INVALID_PRICE;
+        } else if ((long long)(requested[line.productID] += line.quantity) > stock[index].quantity) {
+            result = OP_INSUFFICIENT_STOCK;
+        }
+        if (result != OP_OK) {
+            if (failedLine) *failedLine = i;
+            return result;
+        }
+    }
+    return OP_OK;
+}
+
+// Adds qty units to an existing item
+OpResult applyRestock(size_t index, int qty) {
+    if (index >= stock.size()) return OP_NOT_FOUND;
+    if (qty < 0) return OP_INVALID_QUANTITY;
+
+    StockItem& item = stock.edit(index);
+    item.quantity += qty;
+    syncColumns(index);
+    journalRestock(item.productID, qty);
+    return OP_OK;
+}
+
+// Adds a new item after checking that its ID and name are free
+OpResult applyAdd(const StockItem& item) {
+    if (item.productID <= 0) return OP_INVALID_ID;
+    if (!inShard(item.productID)) return OP_WRONG_SHARD;
+    if (!isValidProductID(item.productID)) return OP_DUPLICATE_ID;
+    if (item.name.empty()) return OP_INVALID_NAME;
+    if (findItemIndexByName(item.name) >= 0) return OP_DUPLICATE_NAME;
+    if (item.quantity < 0) return OP_INVALID_QUANTITY;
+    if (item.lastPrice < 0) return OP_INVALID_PRICE;
+
+    insertItem(item);
+    journalAdd(item);
+    return OP_OK;
+}
+
+// Replaces every field of stock[index] (except the date added) with those of updated
+OpResult applyUpdate(size_t index, const StockItem& updated) {
+    if (index >= stock.size()) return OP_NOT_FOUND;
+    if (updated.productID <= 0) return OP_INVALID_ID;
+    if (updated.productID != stock[index].productID && !inShard(updated.productID)) return OP_WRONG_SHARD;
+    if (!isValidProductID(updated.productID, (int)index)) return OP_DUPLICATE_ID;
+    if (updated.name.empty()) return OP_INVALID_NAME;
+    int existing = findItemIndexByName(updated.name);
+    if (existing >= 0 && existing != (int)index) return OP_DUPLICATE_NAME;
+    if (updated.quantity < 0) return OP_INVALID_QUANTITY;
+    if (updated.lastPrice < 0) return OP_INVALID_PRICE;
+
+    StockItem& item = stock.edit(index);
+    int oldID = item.productID;
+    string oldName = item.name;
+    item.productID = updated.productID;
+    item.name = updated.name;
+    item.categoryID = updated.categoryID;
+    item.quantity = updated.quantity;
+    item.lastPrice = updated.lastPrice;
+    reindexItem(index, oldID, oldName);
+    journalUpdate(oldID, item);
+    return OP_OK;
+}
+
+// Removes stock[index]
+OpResult applyDelete(size_t index) {
+    if (index >= stock.size()) return OP_NOT_FOUND;
+    int id = stock[index].productID;
+    removeItemAt(index);
+    journalDelete(id);
+    return OP_OK;
+}
+
+const char* opResultText(OpResult result) {
+    switch (result) {
+        case OP_OK: return "OK";
+        case OP_NOT_FOUND: return "item not found";
+        case OP_INVALID_ID: return "product ID must be positive";
+        case OP_DUPLICATE_ID: return "product ID already in use";
+        case OP_INVALID_NAME: return "item name cannot be empty";
+        case OP_DUPLICATE_NAME: return "item name already in use";
+        case OP_INVALID_QUANTITY: return "invalid quantity";
+        case OP_INSUFFICIENT_STOCK: return "not enough stock";
+        case OP_INVALID_PRICE: return "invalid price";
+        case OP_INVALID_COMMAND: return "unrecognised command";
+        case OP_MALFORMED: return "malformed number";
+        case OP_EMPTY_BASKET: return "basket is empty";
+        case OP_FIELD_COUNT: return "expected id,name,category,quantity,price[,date_added]";
+        case OP_WRONG_SHARD: return "product ID belongs to another shard";
+    }
+    return "unknown error";
+}
+
+namespace Inventory {
+
+bool batchActive = false;
+BatchSummary batchTotals = {};
+
+// Logs one engine action, or only counts it while a batch is running. The
+// history text comes from describe(), which a batch never calls, so a batch
+// formats no per-change lines.
+template <typename Describe>
+void record(ActionType type, int productID, int quantity, Money price, Describe describe) {
+    if (batchActive) {
+        switch (type) {
+            case ACTION_SALE: batchTotals.sold++; batchTotals.revenue += price * quantity; break;
+            case ACTION_RESTOCK: batchTotals.restocked++; break;
+            case ACTION_ADD: batchTotals.added++; break;
+            case ACTION_UPDATE: batchTotals.changed++; break;
+            case ACTION_DELETE: batchTotals.removed++; break;
+            default: break;
+        }
+        return;
+    }
+    logAction(type, productID, quantity, price, describe());
+}
+
+void recordRestock(const StockItem& item, int qty) {
+    record(ACTION_RESTOCK, item.productID, qty, item.lastPrice, [&] {
+        return "RESTOCK: Added " + to_string(qty) + " units to " + item.name +
+               " (New total: " + to_string(item.quantity) + ")";
+    });
+}
+
+void recordAdd(const StockItem& item) {
+    record(ACTION_ADD, item.productID, item.quantity, item.lastPrice, [&] {
+        return "NEW ITEM: Added " + item.name + " (ID: " + to_string(item.productID) +
+               ", Category: " + categoryName(item.categoryID) + ", Qty: " + to_string(item.quantity) + ")";
+    });
+}
+
+OpResult sell(int id, int qty, Money price) {
+    MetricTimer timer(METRIC_SALE);
+    shared_lock<shared_mutex> store(storeMutex);
+    int index = findItemIndexByID(id);
+    if (index < 0) {
+        countEvent(COUNTER_REJECTED_SALES);
+        return OP_NOT_FOUND;
+    }
+    lock_guard<mutex> itemGuard(itemLock(id));
+    OpResult result = applySale(index, qty, price);
+    if (result != OP_OK) {
+        countEvent(COUNTER_REJECTED_SALES);
+        return result;
+    }
+    recordSales(Basket{{id, qty, price}});
+
+    const StockItem& item = stock[index];
+    record(ACTION_SALE, id, qty, price, [&] {
+        return "SALE: " + to_string(qty) + "x " + item.name + " @ $" + formatMoney(price) +
+               " each = $" + formatMoney(price * qty) + " (Remaining: " + to_string(item.quantity) + ")";
+    });
+    return OP_OK;
+}
+
+// Checks out a basket as one transaction: the stripe locks of every item are held
+// (in a fixed order, so two baskets cannot deadlock) while all lines are validated
+// and applied. If any line fails nothing changes and failedLine says which one.
+// The basket is written as one journal record and one history line.
+OpResult checkout(const Basket& basket, size_t* failedLine) {
+    MetricTimer timer(METRIC_CHECKOUT);
+    shared_lock<shared_mutex> store(storeMutex);
+    vector<size_t> stripes;
+    for (const BasketLine& line : basket) stripes.push_back((unsigned)line.productID % ITEM_LOCK_STRIPES);
+    sort(stripes.begin(), stripes.end());
+    stripes.erase(unique(stripes.begin(), stripes.end()), stripes.end());
+    vector<unique_lock<mutex>> itemGuards;
+    for (size_t stripe : stripes) itemGuards.emplace_back(itemLocks[stripe]);
+
+    OpResult result = validateBasket(basket, failedLine);
+    if (result != OP_OK) {
+        countEvent(COUNTER_REJECTED_SALES);
+        return result;
+    }
+
+    vector<pair<size_t, int>> previousQuantities; // (position, quantity before the basket)
+    for (const BasketLine& line : basket) {
+        size_t index = (size_t)findItemIndexByID(line.productID);
+        previousQuantities.emplace_back(index, stock[index].quantity);
+        applySaleChange(index, line.quantity, line.price);
+    }
+    journalBasket(basket);
+    recordSales(basket);
+
+    // A repeated item is checked once, against its quantity before the first line
+    stable_sort(previousQuantities.begin(), previousQuantities.end(),
+                [](const pair<size_t, int>& a, const pair<size_t, int>& b) { return a.first < b.first; });
+    for (size_t i = 0; i < previousQuantities.size(); ++i) {
+        if (i == 0 || previousQuantities[i].first != previousQuantities[i - 1].first) {
+            checkLowStock(previousQuantities[i].first, previousQuantities[i].second);
+        }
+    }
+
+    // One history line per basket line, like separate sales of the same items
+    for (size_t i = 0; i < basket.size(); ++i) {
+        const BasketLine& line = basket[i];
+        record(ACTION_SALE, line.productID, line.quantity, line.price, [&] {
+            const StockItem& item = stock[findItemIndexByID(line.productID)];
+            return "SALE: " + to_string(line.quantity) + "x " + item.name + " @ $" + formatMoney(line.price) +
+                   " each = $" + formatMoney(line.price * line.quantity) + " (Basket line " + to_string(i + 1) +
+                   " of " + to_string(basket.size()) + ", Remaining: " + to_string(item.quantity) + ")";
+        });
+    }
+    return OP_OK;
+}
+
+OpResult restock(int id, int qty) {
+    shared_lock<shared_mutex> store(storeMutex);
+    int index = findItemIndexByID(id);
+    if (index < 0) return OP_NOT_FOUND;
+    lock_guard<mutex> itemGuard(itemLock(id));
+    OpResult result = applyRestock(index, qty);
+    if (result != OP_OK) return result;
+
+    recordRestock(stock[index], qty);
+    return OP_OK;
+}
+
+OpResult add(const StockItem& item) {
+    unique_lock<shared_mutex> store(storeMutex);
+    OpResult result = applyAdd(item);
+    if (result != OP_OK) return result;
+
+    recordAdd(item);
+    return OP_OK;
+}
+
+// Same rule as addNewItem(): a name already in stock means more of that item,
+// so its quantity goes up (ID, category and price in the row are not applied);
+// a new name is added, provided its ID is free. The category is only interned
+// for rows that really add an item.
+OpResult receive(const StockItem& item, const string& category) {
+    unique_lock<shared_mutex> store(storeMutex);
+    int index = findItemIndexByName(item.name);
+    if (index >= 0) {
+        OpResult result = applyRestock(index, item.quantity);
+        if (result != OP_OK) return result;
+        recordRestock(stock[index], item.quantity);
+        return OP_OK;
+    }
+    if (item.productID <= 0) return OP_INVALID_ID;
+    if (!inShard(item.productID)) return OP_WRONG_SHARD;
+    if (!isValidProductID(item.productID)) return OP_DUPLICATE_ID;
+
+    StockItem added = item;
+    added.categoryID = internCategory(category.empty() ? "Other" : category);
+    OpResult result = applyAdd(added);
+    if (result != OP_OK) return result;
+    recordAdd(added);
+    return OP_OK;
+}
+
+OpResult update(int id, const StockItem& item) {
+    unique_lock<shared_mutex> store(storeMutex);
+    int index = findItemIndexByID(id);
+    if (index < 0) return OP_NOT_FOUND;
+    string oldName = batchActive ? string() : string(stock[index].name); // Only for the log line
+    OpResult result = applyUpdate(index, item);
+    if (result != OP_OK) return result;
+
+    record(ACTION_UPDATE, item.productID, item.quantity, item.lastPrice, [&] {
+        return "UPDATE: " + oldName + " (ID:" + to_string(id) + ") -> Updated successfully";
+    });
+    return OP_OK;
+}
+
+OpResult upsert(const StockItem& item) {
+    return findItemIndexByID(item.productID) >= 0 ? update(item.productID, item) : add(item);
+}
+
+OpResult remove(int id) {
+    unique_lock<shared_mutex> store(storeMutex);
+    int index = findItemIndexByID(id);
+    if (index < 0) return OP_NOT_FOUND;
+    StockItem removed = stock[index];
+    OpResult result = applyDelete(index);
+    if (result != OP_OK) return result;
+
+    record(ACTION_DELETE, removed.productID, removed.quantity, removed.lastPrice, [&] {
+        return "DELETE: Removed " + removed.name + " (ID: " + to_string(removed.productID) +
+               ", Had " + to_string(removed.quantity) + " units)";
+    });
+    return OP_OK;
+}
+
+bool get(int id, StockItem& item) {
+    shared_lock<shared_mutex> store(storeMutex);
+    int index = findItemIndexByID(id);
+    if (index < 0) return false;
+    lock_guard<mutex> itemGuard(itemLock(id));
+    item = stock[index];
+    return true;
+}
+
+bool getByName(const string& name, StockItem& item) {
+    shared_lock<shared_mutex> store(storeMutex);
+    int index = findItemIndexByName(name);
+    if (index < 0) return false;
+    lock_guard<mutex> itemGuard(itemLock(stock[index].productID));
+    item = stock[index];
+    return true;
+}
+
+uint16_t category(const string& name) {
+    unique_lock<shared_mutex> store(storeMutex);
+    return internCategory(name);
+}
+
+vector<size_t> query(const string& term) {
+    MetricTimer timer(METRIC_SEARCH);
+    shared_lock<shared_mutex> store(storeMutex);
+    return searchStock(normalizeSearchText(term));
+}
+
+vector<size_t> lowStock(int threshold) {
+    shared_lock<shared_mutex> store(storeMutex);
+    return itemsInQuantityRange(numeric_limits<int>::min(), threshold);
+}
+
+// Tills only wait while the block pointers are copied, not while the report runs
+StockSnapshot snapshot() {
+    unique_lock<shared_mutex> store(storeMutex);
+    return captureStock();
+}
+
+StockSnapshot lowStockView(int threshold, vector<size_t>& outOfStock, vector<size_t>& low) {
+    unique_lock<shared_mutex> store(storeMutex);
+    outOfStock = itemsInQuantityRange(numeric_limits<int>::min(), 1);
+    low = itemsInQuantityRange(1, threshold);
+    return captureStock();
+}
+
+StockSnapshot queryView(const string& term, vector<size_t>& results) {
+    MetricTimer timer(METRIC_SEARCH);
+    unique_lock<shared_mutex> store(storeMutex);
+    results = searchStock(normalizeSearchText(term));
+    return captureStock();
+}
+
+// The totals are a branch-free pass over the columns (it vectorizes), taken
+// with writers excluded so they match the snapshot
+StockSnapshot overviewView(int threshold, StockOverview& overview) {
+    unique_lock<shared_mutex> store(storeMutex);
+    overview = StockOverview();
+    const int* quantities = colQuantity.data();
+    size_t count = colQuantity.size();
+    for (size_t i = 0; i < count; ++i) {
+        int qty = quantities[i];
+        overview.totalQuantity += qty;
+        overview.outOfStock += (qty <= 0);
+        overview.low += (qty > 0) & (qty < threshold);
+    }
+    overview.categoryCount.assign(categoryOptions.size(), 0);
+    for (uint16_t categoryID : colCategoryID) {
+        if (categoryID < overview.categoryCount.size()) overview.categoryCount[categoryID]++;
+    }
+    return captureStock();
+}
+
+vector<ReorderLine> reorder(int days) {
+    shared_lock<shared_mutex> store(storeMutex);
+    return reorderForecast(days);
+}
+
+Money revenue() {
+    return totalRevenue();
+}
+
+void beginBatch() {
+    beginJournalBatch();
+    batchActive = true;
+    batchTotals = BatchSummary();
+}
+
+BatchSummary endBatch() {
+    batchActive = false;
+    endJournalBatch();
+    return batchTotals;
+}
+
+bool countBatchAlert(BatchAlert alert) {
+    if (!batchActive) return false;
+    switch (alert) {
+        case ALERT_LOW_STOCK: batchTotals.lowStockAlerts++; break;
+        case ALERT_REORDER: batchTotals.reorderAlerts++; break;
+    }
+    return true;
+}
+
+} // namespace Inventory
+
+// Splits a comma separated line. Fields may be wrapped in double quotes so
+// names can contain commas; "" inside a quoted field is a literal quote.
+vector<string> splitCsvLine(const string& line) {
+    vector<string> fields;
+    string field;
+    bool quoted = false;
+    for (size_t i = 0; i < line.size(); ++i) {
+        char c = line[i];
+        if (quoted) {
+            if (c == '"' && i + 1 < line.size() && line[i + 1] == '"') {
+                field += '"';
+                ++i;
+            } else if (c == '"') {
+                quoted = false;
+            } else {
+                field += c;
+            }
+        } else if (c == '"') {
+            quoted = true;
+        } else if (c == ',') {
+            fields.push_back(field);
+            field.clear();
+        } else if (c != '\r') {
+            field += c;
+        }
+    }
+    fields.push_back(field);
+    return fields;
+}
+
+// Applies a batch of commands, one per line (blank lines and # comments are skipped):
+//   SALE,id,qty,price
+//   BASKET,id,qty,price[,id,qty,price...]     (all lines are sold, or none)
+//   RESTOCK,id,qty
+//   ADD,id,name,category,qty,price
+//   UPDATE,id,newID,name,category,qty,price   (empty fields keep the current value)
+//   DELETE,id
+// Rejected lines are reported and skipped. The journal is synced and the stock
+// saved once at the end, and the whole batch is logged as a single history line.
+bool runBatch(istream& in, const string& source) {
+    Inventory::beginBatch();
+    int rejected = applyBatchStream(in, source);
+    Inventory::BatchSummary totals = Inventory::endBatch();
+
+    ostringstream summary;
+    summary << totals.sold << " sold ($" << formatMoney(totals.revenue) << "), " << totals.restocked << " restocked, "
+            << totals.added << " new, " << totals.changed << " changed, " << totals.removed << " removed, "
+            << rejected << " rejected";
+    if (totals.lowStockAlerts > 0) summary << ", " << totals.lowStockAlerts << " low stock alerts";
+    if (totals.reorderAlerts > 0) summary << ", " << totals.reorderAlerts << " reorder alerts";
+    logAction("BATCH from " + source + ": " + summary.str());
+    cout << "Batch " << source << ": " << summary.str() << endl;
+    return rejected == 0;
+}
+
+// Applies every command line in the stream through the Inventory engine (safe to
+// run from several threads at once) and returns how many lines were rejected
+int applyBatchStream(istream& in, const string& source) {
+    int rejected = 0;
+    long lineNumber = 0;
+    string line;
+
+    while (getline(in, line)) {
+        ++lineNumber;
+        vector<string> fields = splitCsvLine(line);
+        string command = commandName(fields[0]);
+        if (command.empty()) continue;
+
+        OpResult result = applyCommand(command, fields);
+        if (result != OP_OK) {
+            // Built first so lines from concurrent tills do not interleave
+            string message = source + ":" + to_string(lineNumber) + ": " + opResultText(result) + ": " + line + "\n";
+            cerr << message;
+            rejected++;
+        }
+    }
+    return rejected;
+}
+
+// Imports a supplier/catalog CSV as one batch: rows are read and applied one at
+// a time (memory stays flat however long the file is), and the whole import is
+// synced and checkpointed once at the end
+bool runCatalogImport(istream& in, const string& source) {
+    Inventory::beginBatch();
+    int rejected = applyCatalogStream(in, source);
+    Inventory::BatchSummary totals = Inventory::endBatch();
+
+    ostringstream summary;
+    summary << totals.added << " new, " << totals.restocked << " restocked, " << rejected << " rejected";
+    logAction("IMPORT from " + source + ": " + summary.str());
+    cout << "Import " << source << ": " << summary.str() << endl;
+    return rejected == 0;
+}
+
+// Rows are id,name,category,quantity,price with an optional date_added (seconds
+// since 1970) as written by exportStockCsv(). A first row that does not start
+// with a number is taken as the header; blank lines and # comments are skipped.
+int applyCatalogStream(istream& in, const string& source) {
+    int rejected = 0;
+    long lineNumber = 0;
+    bool firstRow = true;
+    string line;
+
+    while (getline(in, line)) {
+        ++lineNumber;
+        if (lineNumber == 1 && line.compare(0, 3, "\xEF\xBB\xBF") == 0) line.erase(0, 3); // Spreadsheet BOM
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        vector<string> fields = splitCsvLine(line);
+        if (commandName(fields[0]).empty()) continue;
+        bool header = firstRow && !isdigit((unsigned char)fields[0][fields[0].find_first_not_of(" \t")]);
+        firstRow = false;
+        if (header) continue;
+
+        OpResult result;
+        if (fields.size() != 5 && fields.size() != 6) {
+            result = OP_FIELD_COUNT;
+        } else {
+            try {
+                StockItem item;
+                item.productID = stoi(fields[0]);
+                item.name = fields[1];
+                item.quantity = stoi(fields[3]);
+                item.lastPrice = toMoney(fields[4]);
+                if (fields.size() == 6 && !fields[5].empty()) item.dateAdded = (time_t)stoll(fields[5]);
+                result = Inventory::receive(item, fields[2]);
+            } catch (...) {
+                result = OP_MALFORMED;
+            }
+        }
+        if (result != OP_OK) {
+            cerr << source + ":" + to_string(lineNumber) + ": " + opResultText(result) + ": " + line + "\n";
+            rejected++;
+        }
+    }
+    return rejected;
+}
+
+// Upper-cases the first field of a command line; "" for blank lines and # comments
+string commandName(const string& field) {
+    size_t start = field.find_first_not_of(" \t");
+    if (start == string::npos || field[start] == '#') return "";
+    string command = field.substr(start);
+    transform(command.begin(), command.end(), command.begin(), ::toupper);
+    return command;
+}
+
+// Applies one parsed SALE/BASKET/RESTOCK/ADD/UPDATE/DELETE command (command is upper case)
+OpResult applyCommand(const string& command, const vector<string>& fields) {
+    OpResult result = OP_OK;
+    try {
+        int id = fields.size() >= 2 ? stoi(fields[1]) : 0;
+
+        if (command == "SALE" && fields.size() == 4) {
+            result = Inventory::sell(id, stoi(fields[2]), toMoney(fields[3]));
+        } else if (command == "BASKET" && fields.size() >= 4 && (fields.size() - 1) % 3 == 0) {
+            Basket basket;
+            for (size_t i = 1; i + 2 < fields.size(); i += 3) {
+                basket.push_back({stoi(fields[i]), stoi(fields[i + 1]), toMoney(fields[i + 2])});
+            }
+            result = Inventory::checkout(basket);
+        } else if (command == "RESTOCK" && fields.size() == 3) {
+            result = Inventory::restock(id, stoi(fields[2]));
+        } else if (command == "ADD" && fields.size() == 6) {
+            StockItem item;
+            item.productID = id;
+            item.name = fields[2];
+            item.categoryID = Inventory::category(fields[3].empty() ? "Other" : fields[3]);
+            item.quantity = stoi(fields[4]);
+            item.lastPrice = toMoney(fields[5]);
+            result = Inventory::add(item);
+        } else if (command == "UPDATE" && fields.size() == 7) {
+            StockItem item;
+            if (!Inventory::get(id, item)) {
+                result = OP_NOT_FOUND;
+            } else {
+                if (!fields[2].empty()) item.productID = stoi(fields[2]);
+                if (!fields[3].empty()) item.name = fields[3];
+                if (!fields[4].empty()) item.categoryID = Inventory::category(fields[4]);
+                if (!fields[5].empty()) item.quantity = stoi(fields[5]);
+                if (!fields[6].empty()) item.lastPrice = toMoney(fields[6]);
+                result = Inventory::update(id, item);
+            }
+        } else if (command == "DELETE" && fields.size() == 2) {
+            result = Inventory::remove(id);
+        } else {
+            result = OP_INVALID_COMMAND;
+        }
+    } catch (...) {
+        result = OP_MALFORMED;
+    }
+    return result;
+}
+
+// Runs each file as its own till on a separate thread. Every change is journaled
+// and logged as it happens; the stock is checkpointed once all tills are done.
+bool runTills(const vector<string>& paths) {
+    vector<int> rejected(paths.size(), 0);
+    vector<thread> tills;
+    auto started = chrono::steady_clock::now();
+
+    concurrentMode = true;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        tills.emplace_back([&paths, &rejected, i]() {
+            ifstream in(paths[i]);
+            if (!in.is_open()) {
+                cerr << ("Could not read " + paths[i] + "\n");
+                rejected[i] = -1;
+                return;
+            }
+            rejected[i] = applyBatchStream(in, paths[i]);
+        });
+    }
+    for (thread& till : tills) till.join();
+    concurrentMode = false;
+    checkpointStock();
+
+    long elapsedMs = (long)chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - started).count();
+    bool ok = true;
+    int totalRejected = 0;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        if (rejected[i] != 0) ok = false;
+        if (rejected[i] > 0) totalRejected += rejected[i];
+    }
+
+    ostringstream summary;
+    summary << paths.size() << " tills in " << elapsedMs << " ms, " << totalRejected << " lines rejected, revenue now $"
+            << formatMoney(totalRevenue());
+    logAction("TILLS: " + summary.str());
+    cout << "Tills: " << summary.str() << endl;
+    return ok;
+}
+
+// One shard as the central node sees it, after catching its replica up
+struct ShardSummary {
+    string name;
+    size_t items;
+    long long units;
+    Money revenue;
+    long sequence;
+    long applied;   // Records replayed in this run
+    bool rebased;   // Replica was (re)copied from the store's stock.bin
+};
+
+// Per-product totals across the shards (the first shard with the ID names it)
+struct CentralRow {
+    string name;
+    string category;
+    long long quantity;
+    Money lastPrice;
+    time_t dateAdded;
+};
+
+// Replaces the loaded replica with the store's own checkpoint, or with an
+// empty store at sequence 0 if it has never checkpointed
+void rebaseReplica(const string& directory) {
+    resetStore();
+    if (!loadStockSnapshot(directory + '/' + SNAPSHOT_FILE)) resetStore();
+}
+
+// Replays what the store has shipped and then its live journal on top of the
+// loaded replica. Returns the number of records applied, or -1 if they do not
+// follow on from the replica's sequence.
+long catchUpReplica(const string& directory) {
+    bool torn = false;
+    long shipped = applyJournalFile(directory + '/' + SHIP_FILE, true, torn);
+    if (shipped < 0) return -1;
+    long live = applyJournalFile(directory + '/' + JOURNAL_FILE, true, torn);
+    return live < 0 ? -1 : shipped + live;
+}
+
+// Central node (--central FILE): FILE has one "name,directory" line per shard
+// (a branch, or a product ID range run with --shard). Each shard has a replica
+// here, replica.<name>.bin, which is caught up with the records its store has
+// shipped and saved again; the sequence it reached is acknowledged in the
+// store's stock.ship.ack. A missing replica, or one the shipped records no
+// longer reach, is copied from the store's checkpoint first. Only one replica
+// is in memory at a time; across shards just one total row per product is
+// kept, and written out as central.csv in the columns of --export-csv.
+bool runCentral(const string& shardList) {
+    ifstream list(shardList);
+    if (!list.is_open()) {
+        cerr << "Could not read " << shardList << endl;
+        return false;
+    }
+    vector<pair<string, string>> shards;
+    set<string> names;
+    string line;
+    int lineNumber = 0;
+    bool ok = true;
+    while (getline(list, line)) {
+        ++lineNumber;
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+        size_t comma = line.find(',');
+        string name = line.substr(0, comma);
+        bool validName = !name.empty() && all_of(name.begin(), name.end(), [](char c) {
+            return isalnum((unsigned char)c) || c == '_' || c == '-';
+        });
+        if (comma == string::npos || comma + 1 == line.size() || !validName || !names.insert(name).second) {
+            cerr << shardList << " line " << lineNumber << ": expected a unique name,directory" << endl;
+            ok = false;
+            continue;
+        }
+        shards.push_back({name, line.substr(comma + 1)});
+    }
+    if (shards.empty()) {
+        cerr << "No shards listed in " << shardList << endl;
+        return false;
+    }
+
+    map<int, CentralRow> totals;
+    vector<ShardSummary> summaries;
+    for (const auto& shard : shards) {
+        const string& directory = shard.second;
+        string replicaPath = "replica." + shard.first + ".bin";
+        resetStore();
+        bool rebased = !loadStockSnapshot(replicaPath);
+        if (rebased) rebaseReplica(directory);
+        long applied = catchUpReplica(directory);
+        if (applied < 0 && !rebased) {
+            rebased = true;
+            rebaseReplica(directory);
+            applied = catchUpReplica(directory);
+        }
+        if (applied < 0) {
+            cerr << "Shard " << shard.first << ": the records in " << directory
+                 << " do not follow on from its checkpoint, skipped" << endl;
+            ok = false;
+            continue;
+        }
+
+        checkpointSequence = journalSequence;
+        if (!saveStockSnapshot(replicaPath)) {
+            cerr << "Error saving " << replicaPath << "!" << endl;
+            ok = false;
+        } else {
+            // Acknowledged only once the replica holds the records durably
+            string ackPath = directory + '/' + SHIP_ACK_FILE;
+            FILE* ack = openAtomicWrite(ackPath);
+            if (ack) fprintf(ack, "%ld\n", journalSequence);
+            if (!ack || !commitAtomicWrite(ack, ackPath)) {
+                cerr << "Could not write " << ackPath << endl;
+                ok = false;
+            }
+        }
+
+        ShardSummary summary = {shard.first, stock.size(), 0, totalRevenue(), journalSequence, applied, rebased};
+        for (size_t i = 0; i < stock.size(); ++i) {
+            const StockItem& item = stock[i];
+            summary.units += item.quantity;
+            auto row = totals.find(item.productID);
+            if (row == totals.end()) {
+                totals.emplace(item.productID, CentralRow{item.name, categoryName(item.categoryID), item.quantity,
+                                                          item.lastPrice, item.dateAdded});
+            } else {
+                row->second.quantity += item.quantity;
+                row->second.dateAdded = min(row->second.dateAdded, item.dateAdded);
+            }
+        }
+        summaries.push_back(summary);
+    }
+    resetStore();
+
+    FILE* file = openAtomicWrite(CENTRAL_CATALOG_FILE);
+    if (file) {
+        string text = "id,name,category,quantity,price,date_added\n";
+        text.reserve(EXPORT_FLUSH_BYTES + 1024);
+        for (const auto& entry : totals) {
+            const CentralRow& row = entry.second;
+            text += to_string(entry.first);
+            text += ',';
+            text += csvField(row.name);
+            text += ',';
+            text += csvField(row.category);
+            text += ',';
+            text += to_string(row.quantity);
+            text += ',';
+            appendMoney(text, row.lastPrice);
+            text += ',';
+            text += to_string((long long)row.dateAdded);
+            text += '\n';
+            if (text.size() >= EXPORT_FLUSH_BYTES) {
+                fwrite(text.data(), 1, text.size(), file);
+                text.clear();
+            }
+        }
+        fwrite(text.data(), 1, text.size(), file);
+    }
+    if (!file || !commitAtomicWrite(file, CENTRAL_CATALOG_FILE)) {
+        cerr << "Could not write " << CENTRAL_CATALOG_FILE << endl;
+        ok = false;
+    }
+
+    long long totalUnits = 0;
+    Money totalSales = 0;
+    cout << left << setw(16) << "Shard" << right << setw(10) << "Items" << setw(12) << "Units"
+         << setw(16) << "Revenue" << setw(12) << "Sequence" << setw(10) << "Applied" << "  Rebased" << endl;
+    for (const ShardSummary& summary : summaries) {
+        totalUnits += summary.units;
+        totalSales += summary.revenue;
+        cout << left << setw(16) << summary.name << right << setw(10) << summary.items << setw(12) << summary.units
+             << setw(16) << ("$" + formatMoney(summary.revenue)) << setw(12) << summary.sequence
+             << setw(10) << summary.applied << (summary.rebased ? "  yes" : "  no") << endl;
+    }
+    cout << left << setw(16) << "TOTAL" << right << setw(10) << totals.size() << setw(12) << totalUnits
+         << setw(16) << ("$" + formatMoney(totalSales)) << endl;
+
+    ostringstream summary;
+    summary << summaries.size() << " of " << shards.size() << " shards, " << totals.size() << " products, "
+            << totalUnits << " units, revenue $" << formatMoney(totalSales);
+    logAction("CENTRAL: " + summary.str());
+    cout << "Central: " << summary.str() << " (" << CENTRAL_CATALOG_FILE << ")" << endl;
+    return ok;
+}
+
+// Benchmark (--bench): latency samples of one kind of operation, in microseconds
+struct BenchSeries {
+    string name;
+    vector<double> samples;
+};
+
+static double microsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+}
+
+// One result row: count, total time, throughput and p50/p99/max latency
+static void printBenchSeries(BenchSeries& series) {
+    vector<double>& samples = series.samples;
+    if (samples.empty()) return;
+    double total = 0;
+    for (double sample : samples) total += sample;
+    sort(samples.begin(), samples.end());
+    auto percentile = [&samples](double p) { return samples[min(samples.size() - 1, (size_t)(p * samples.size()))]; };
+    cout << left << setw(20) << series.name << right << setw(9) << samples.size()
+         << fixed << setprecision(1) << setw(12) << total / 1000.0
+         << setprecision(0) << setw(12) << (total > 0 ? samples.size() * 1e6 / total : 0.0)
+         << setprecision(1) << setw(12) << percentile(0.50) << setw(12) << percentile(0.99)
+         << setw(12) << samples.back() << endl;
+}
+
+// Creates dir if needed, makes it the working directory and removes the data
+// files a previous run left there. The logger is stopped first, as it has the
+// starting directory's history.log open; on failure it is started again there.
+bool enterScratchDirectory(const string& dir) {
+    stopLogger();
+    #ifdef _WIN32
+        _mkdir(dir.c_str());
+        bool entered = _chdir(dir.c_str()) == 0;
+    #else
+        mkdir(dir.c_str(), 0755);
+        bool entered = chdir(dir.c_str()) == 0;
+    #endif
+    if (!entered) {
+        startLogger();
+        return false;
+    }
+    for (const char* file : {SNAPSHOT_FILE, TEXT_STOCK_FILE, JOURNAL_FILE, HISTORY_FILE, HISTORY_INDEX_FILE,
+                             "grand_total.dat", SALES_LEDGER_FILE, SALES_ROLLUP_FILE, SHIP_FILE, SHIP_ACK_FILE}) {
+        remove(file);
+    }
+    return true;
+}
+
+// Generates a synthetic catalog (plus a matching history.log) in dir, then times
+// loading, saving, searches, low stock queries and a mixed sale/restock/search
+// workload against the Inventory engine. Everything runs through the same code
+// paths as the menu and batch mode, journal and logger included.
+bool runBenchmark(const string& dir, int items, int ops) {
+    if (!enterScratchDirectory(dir)) {
+        cerr << "Could not use benchmark directory " << dir << endl;
+        return false;
+    }
+
+    static const char* const words[] = {
+        "Apple", "Banana", "Cherry", "Crunchy", "Fresh", "Golden", "Green", "Honey",
+        "Lemon", "Mango", "Mild", "Organic", "Peanut", "Plain", "Red", "Salted",
+        "Smoked", "Spicy", "Sweet", "Whole", "Bread", "Cheese", "Chips", "Coffee",
+        "Cookies", "Juice", "Milk", "Pasta", "Rice", "Soda", "Tea", "Yogurt"};
+    const size_t wordCount = sizeof(words) / sizeof(words[0]);
+    mt19937 rng(20240601);
+    auto pick = [&rng](size_t n) { return (size_t)(rng() % n); };
+
+    vector<BenchSeries> results;
+    auto timeOnce = [&results](const string& name, auto&& operation) {
+        auto start = chrono::steady_clock::now();
+        operation();
+        results.push_back({name, {microsSince(start)}});
+    };
+    cout << "Benchmark: " << items << " items, " << ops << " operations in " << dir << endl;
+
+    // Synthetic catalog: unique "<word> <word> <n>" names spread over the categories
+    timeOnce("generate catalog", [&] {
+        stock.clear();
+        stock.reserve(items);
+        grandTotalSales = 0;
+        StockItem item;
+        for (int i = 1; i <= items; ++i) {
+            item.productID = i;
+            item.name = string(words[pick(wordCount)]) + ' ' + words[pick(wordCount)] + ' ' + to_string(i);
+            item.categoryID = internCategory(categoryOptions[pick(9)]);
+            item.quantity = 20 + (int)pick(1000);
+            item.lastPrice = 50 + (Money)pick(5000);
+            stock.push_back(item);
+        }
+        rebuildIndexes();
+    });
+
+    // Synthetic history.log: one sale line per item
+    {
+        ofstream history(HISTORY_FILE, ios::trunc);
+        string lines;
+        string stamp = "[" + formatTimestamp(time(0)) + "] ";
+        for (int i = 0; i < items; ++i) {
+            const StockItem& item = stock[i];
+            lines += stamp + "SALE: 1x " + item.name + " @ $" + formatMoney(item.lastPrice) + " each = $" +
+                     formatMoney(item.lastPrice) + " (Remaining: " + to_string(item.quantity) + ")\n";
+            if (lines.size() >= 1 << 20) {
+                history << lines;
+                lines.clear();
+            }
+        }
+        history << lines;
+    }
+    timeOnce("index history", [&] {
+        startLogger(); // Catches history.idx up with the whole log
+        loadRecentHistory();
+    });
+
+    const int fileRounds = 3;
+    BenchSeries saveSnapshot = {"save snapshot", {}}, saveText = {"save text", {}};
+    BenchSeries loadSnapshot = {"load snapshot", {}}, loadText = {"load text", {}};
+    for (int round = 0; round < fileRounds; ++round) {
+        auto start = chrono::steady_clock::now();
+        saveStockSnapshot(SNAPSHOT_FILE);
+        saveSnapshot.samples.push_back(microsSince(start));
+        start = chrono::steady_clock::now();
+        exportStockText(TEXT_STOCK_FILE);
+        saveText.samples.push_back(microsSince(start));
+    }
+    for (int round = 0; round < fileRounds; ++round) {
+        auto start = chrono::steady_clock::now();
+        loadStockSnapshot(SNAPSHOT_FILE);
+        loadSnapshot.samples.push_back(microsSince(start));
+        start = chrono::steady_clock::now();
+        importStockText(TEXT_STOCK_FILE);
+        loadText.samples.push_back(microsSince(start));
+    }
+    results.push_back(saveSnapshot);
+    results.push_back(saveText);
+    results.push_back(loadSnapshot);
+    results.push_back(loadText);
+
+    // Mixed workload: 60% sales, 10% three-line baskets, 15% restocks,
+    // 10% searches (half a word shared by many items, half one exact name)
+    // and 5% low stock reports
+    openJournal();
+    BenchSeries sales = {"sale", {}}, baskets = {"basket checkout", {}}, restocks = {"restock", {}};
+    BenchSeries broadSearches = {"search (word)", {}}, narrowSearches = {"search (name)", {}};
+    BenchSeries lowStockQueries = {"low stock", {}};
+    size_t matched = 0;
+    auto workloadStart = chrono::steady_clock::now();
+    for (int i = 0; i < ops; ++i) {
+        int roll = (int)pick(100);
+        int id = 1 + (int)pick(items);
+        auto start = chrono::steady_clock::now();
+        if (roll < 60) {
+            Inventory::sell(id, 1, stock[id - 1].lastPrice);
+            sales.samples.push_back(microsSince(start));
+        } else if (roll < 70) {
+            Basket basket;
+            for (int line = 0; line < 3; ++line) {
+                int lineID = 1 + (int)pick(items);
+                basket.push_back({lineID, 1, stock[lineID - 1].lastPrice});
+            }
+            start = chrono::steady_clock::now();
+            Inventory::checkout(basket);
+            baskets.samples.push_back(microsSince(start));
+        } else if (roll < 85) {
+            Inventory::restock(id, 5);
+            restocks.samples.push_back(microsSince(start));
+        } else if (roll < 90) {
+            string term = words[pick(wordCount)];
+            start = chrono::steady_clock::now();
+            matched += Inventory::query(term).size();
+            broadSearches.samples.push_back(microsSince(start));
+        } else if (roll < 95) {
+            string term = stock[id - 1].name;
+            start = chrono::steady_clock::now();
+            matched += Inventory::query(term).size();
+            narrowSearches.samples.push_back(microsSince(start));
+        } else {
+            matched += Inventory::lowStock(lowStockThreshold).size();
+            lowStockQueries.samples.push_back(microsSince(start));
+        }
+    }
+    double workloadMicros = microsSince(workloadStart);
+    for (BenchSeries* series : {&sales, &baskets, &restocks, &broadSearches, &narrowSearches, &lowStockQueries}) {
+        results.push_back(*series);
+    }
+    timeOnce("checkpoint", [] { checkpointStock(); });
+    closeJournal();
+
+    cout << left << setw(20) << "Operation" << right << setw(9) << "Count" << setw(12) << "Total ms"
+         << setw(12) << "Ops/s" << setw(12) << "p50 us" << setw(12) << "p99 us" << setw(12) << "Max us" << endl;
+    cout << string(89, '-') << endl;
+    for (BenchSeries& series : results) printBenchSeries(series);
+    cout << string(89, '-') << endl;
+    cout << "Workload: " << ops << " operations in " << fixed << setprecision(1) << workloadMicros / 1000.0
+         << " ms (" << setprecision(0) << ops * 1e6 / workloadMicros << " ops/s), " << matched
+         << " rows returned, revenue $" << formatMoney(totalRevenue()) << endl;
+    cout.unsetf(ios::floatfield);
+    return true;
+}
+
+// Self test: each check prints one line and a failure is counted, so one run
+// reports everything that is wrong rather than stopping at the first problem
+static int selfTestFailures = 0;
+
+static void selfCheck(bool passed, const string& what) {
+    cout << (passed ? "ok    " : "FAIL  ") << what << endl;
+    if (!passed) selfTestFailures++;
+}
+
+// Compresses text as a frame and reads it back; the frame is left in frame
+static bool lz4RoundTrip(const string& text, string& frame) {
+    string back;
+    lz4CompressFrame(text, frame);
+    return lz4DecompressFrame(frame, back) && back == text;
+}
+
+// LZ4 frames and xxHash32: known values from the reference implementation (the
+// xxHash test vectors, and a frame written by the lz4 tool), then round trips
+// over the cases the encoder treats specially
+static void selfTestLz4() {
+    const string repeated = "stock stock stock stock stock stock stock!"; // 42 bytes, so the 16-byte lanes run too
+    selfCheck(xxHash32("", 0, 0) == 0x02CC5D05U, "xxHash32 of empty input");
+    selfCheck(xxHash32("abc", 3, 0) == 0x32D153FFU, "xxHash32 of \"abc\"");
+    selfCheck(xxHash32(repeated.data(), repeated.size(), 0) == 0xA7DB86CEU, "xxHash32 of 42 bytes");
+    const unsigned char blocks64K[2] = {0x64, 0x40}, blocks4M[2] = {0x64, 0x70};
+    selfCheck(((xxHash32(blocks64K, 2, 0) >> 8) & 0xFF) == 0xA7 && ((xxHash32(blocks4M, 2, 0) >> 8) & 0xFF) == 0xB9,
+              "LZ4 frame header checksums");
+
+    // lz4 -c of the 42 bytes above: one compressed block whose match overlaps its own output
+    static const unsigned char toolFrame[] = {
+        0x04, 0x22, 0x4d, 0x18, 0x64, 0x40, 0xa7, 0x10, 0x00, 0x00, 0x00, 0x6f,
+        0x73, 0x74, 0x6f, 0x63, 0x6b, 0x20, 0x06, 0x00, 0x0c, 0x50, 0x74, 0x6f,
+        0x63, 0x6b, 0x21, 0x00, 0x00, 0x00, 0x00, 0xce, 0x86, 0xdb, 0xa7};
+    string toolText;
+    selfCheck(lz4DecompressFrame(string((const char*)toolFrame, sizeof(toolFrame)), toolText) && toolText == repeated,
+              "frame written by the lz4 tool");
+
+    string frame;
+    selfCheck(lz4RoundTrip("", frame) && frame.size() == 15, "empty input (header, end mark and checksum only)");
+    bool shortInputs = true;
+    for (size_t length = 1; length <= 32; ++length) {
+        shortInputs = shortInputs && lz4RoundTrip(string(length, 'x'), frame) && lz4RoundTrip(repeated.substr(0, length), frame);
+    }
+    selfCheck(shortInputs, "inputs of 1-32 bytes (around the end-of-block literal rules)");
+
+    mt19937 rng(20240601);
+    string noise(1 << 20, '\0');
+    for (char& c : noise) c = (char)(rng() & 0xFF);
+    selfCheck(lz4RoundTrip(noise, frame) && frame.size() == noise.size() + 19, "incompressible input is stored raw");
+    selfCheck(lz4RoundTrip(string(3 << 20, 'a'), frame) && frame.size() < 20000, "one 3 MB match (long length fields)");
+    // Single blocks (a frame would store the noise raw) whose literal and match
+    // lengths step over 15 + 255, where a length field gains a byte
+    bool lengthSteps = true;
+    for (size_t length = 250; length <= 540; ++length) {
+        for (const string& text : {noise.substr(0, length), string(length, 'a')}) {
+            string block, back;
+            lz4CompressBlock(text.data(), text.size(), block);
+            lengthSteps = lengthSteps && lz4DecompressBlock((const unsigned char*)block.data(), block.size(), back) && back == text;
+        }
+    }
+    selfCheck(lengthSteps, "blocks with 250-540 byte literal runs and matches");
+
+    string lines;
+    for (int i = 0; lines.size() < (1 << 20); ++i) {
+        lines += "[Mon Jun  3 10:" + to_string(10 + i % 50) + ":00 2024] SALE: " + to_string(1 + i % 7) + "x Item " +
+                 to_string(i % 997) + " @ $1.25 each (Remaining: " + to_string(i % 300) + ")\n";
+    }
+    selfCheck(lz4RoundTrip(lines, frame) && frame.size() < lines.size() / 2, "history lines compress");
+
+    // Block size boundary: one byte short of, exactly and just past one block,
+    // and a raw block followed by a compressed one
+    bool boundaries = true;
+    for (size_t length : {LZ4_BLOCK_BYTES - 1, LZ4_BLOCK_BYTES, LZ4_BLOCK_BYTES + 1, 2 * LZ4_BLOCK_BYTES}) {
+        string text;
+        while (text.size() < length) text += lines;
+        text.resize(length);
+        boundaries = boundaries && lz4RoundTrip(text, frame);
+    }
+    string mixed = noise;
+    while (mixed.size() < LZ4_BLOCK_BYTES + lines.size()) mixed += noise;
+    mixed.resize(LZ4_BLOCK_BYTES);
+    mixed += lines;
+    boundaries = boundaries && lz4RoundTrip(mixed, frame);
+    selfCheck(boundaries, "inputs at the 4 MB block boundary");
+
+    // Damage must be detected, never decoded into something else
+    lz4CompressFrame(lines, frame);
+    string damaged = frame, text;
+    damaged[damaged.size() / 2] ^= 0x20;
+    bool rejected = !lz4DecompressFrame(damaged, text);
+    rejected = rejected && !lz4DecompressFrame(frame.substr(0, frame.size() - 1), text);
+    damaged = frame;
+    damaged[6] ^= 0x01; // Header checksum
+    rejected = rejected && !lz4DecompressFrame(damaged, text);
+    const unsigned char before[] = {0x00, 0x01, 0x00}; // A match at offset 1 with nothing decoded yet
+    text.clear();
+    rejected = rejected && !lz4DecompressBlock(before, sizeof(before), text);
+    selfCheck(rejected, "damaged frames and blocks are rejected");
+
+    // Through the archive file, as the history screen reads rotated segments
+    FILE* archive = openAtomicWrite(historySegmentPath(1, true));
+    bool written = archive && fwrite(frame.data(), 1, frame.size(), archive) == frame.size() &&
+                   commitAtomicWrite(archive, historySegmentPath(1, true));
+    selfCheck(written && readHistorySegment(1, text) && text == lines, "history archive written and read back");
+    remove(historySegmentPath(1, true).c_str());
+}
+
+// Writes bytes as path, replacing it
+static bool writeSelfTestFile(const string& path, const string& bytes) {
+    ofstream out(path, ios::binary | ios::trunc);
+    out.write(bytes.data(), (streamsize)bytes.size());
+    return (bool)out;
+}
+
+// Snapshots: a multi-segment stock.bin must load back as saved, and a damaged
+// one (truncated anywhere, or with sizes that only fit the file once they wrap
+// around) must be refused without reading past the end, so that
+// loadStockFromFile() falls back to stock.dat
+static void selfTestSnapshot() {
+    stock.clear();
+    rebuildIndexes();
+    const size_t items = SNAPSHOT_SEGMENT_ITEMS + 100; // Two segments
+    long long totalQuantity = 0;
+    for (size_t i = 1; i <= items; ++i) {
+        StockItem item;
+        item.productID = (int)i;
+        item.name = "Item " + to_string(i) + (i % 1000 == 0 ? string(300, 'x') : string());
+        item.categoryID = internCategory(i % 2 ? "Fruits" : "Dairy");
+        item.quantity = (int)(i % 50);
+        item.lastPrice = (Money)(i % 1000);
+        insertItem(item);
+        totalQuantity += item.quantity;
+    }
+    grandTotalSales = 123456;
+    bool saved = saveStockSnapshot(SNAPSHOT_FILE);
+    stock.clear();
+    rebuildIndexes();
+    bool loaded = saved && loadStockSnapshot(SNAPSHOT_FILE) && stock.size() == items;
+    long long loadedQuantity = 0;
+    for (size_t i = 0; loaded && i < stock.size(); ++i) loadedQuantity += stock[i].quantity;
+    int last = findItemIndexByID((int)items);
+    loaded = loaded && loadedQuantity == totalQuantity && grandTotalSales == 123456 && last >= 0 &&
+             string(stock[last].name) == "Item " + to_string(items) && categoryName(stock[last].categoryID) == "Dairy";
+    selfCheck(loaded, "stock.bin with " + to_string(items) + " items in 2 segments saved and loaded back");
+
+    ifstream in(SNAPSHOT_FILE, ios::binary);
+    ostringstream contents;
+    contents << in.rdbuf();
+    in.close();
+    const string good = contents.str();
+    const size_t table = sizeof(SnapshotHeader) + sizeof(uint64_t); // First segment entry
+    auto refused = [](const string& bytes) {
+        stock.clear();
+        return writeSelfTestFile(SNAPSHOT_FILE, bytes) && !loadStockSnapshot(SNAPSHOT_FILE);
+    };
+
+    bool truncated = true;
+    for (size_t length : {(size_t)0, SNAPSHOT_V1_HEADER_SIZE - 1, sizeof(SnapshotHeader), table + sizeof(SnapshotSegment),
+                          table + 2 * sizeof(SnapshotSegment) + 1, good.size() / 2, good.size() - 1}) {
+        truncated = truncated && refused(good.substr(0, length));
+    }
+    selfCheck(truncated, "truncated stock.bin is refused");
+    selfCheck(refused(good + '\0'), "stock.bin with trailing bytes is refused");
+
+    // A first segment whose pool size only fits the file modulo 2^64
+    string wrapped = good;
+    uint64_t hugePool = UINT64_MAX - 99;
+    memcpy(&wrapped[table + offsetof(SnapshotSegment, poolSize)], &hugePool, sizeof(hugePool));
+    bool wrapRefused = refused(wrapped);
+    // Version 3 (one pool): record and pool sizes that add up to the file length
+    // only after wrapping around
+    SnapshotHeader header = {};
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version = 3;
+    header.itemCount = UINT32_MAX;
+    string oldFormat((const char*)&header, sizeof(header));
+    oldFormat += string(sizeof(SnapshotRecord) + 2, '\0');
+    header.poolSize = (uint64_t)oldFormat.size() - sizeof(header) - (uint64_t)header.itemCount * sizeof(SnapshotRecord);
+    memcpy(&oldFormat[0], &header, sizeof(header));
+    wrapRefused = wrapRefused && refused(oldFormat);
+    selfCheck(wrapRefused, "stock.bin sizes that wrap around are refused");
+
+    // The loader falls back to the text file, as for any other bad snapshot
+    StockItem fallback;
+    fallback.productID = 7;
+    fallback.name = string("Fallback");
+    stock.clear();
+    insertItem(fallback);
+    bool exported = exportStockText(TEXT_STOCK_FILE);
+    stock.clear();
+    rebuildIndexes();
+    writeSelfTestFile(SNAPSHOT_FILE, good.substr(0, good.size() / 2));
+    loadStockFromFile();
+    selfCheck(exported && stock.size() == 1 && stock[0].productID == 7, "truncated stock.bin falls back to stock.dat");
+
+    remove(SNAPSHOT_FILE);
+    remove(TEXT_STOCK_FILE);
+    stock.clear();
+    rebuildIndexes();
+    grandTotalSales = 0;
+}
+
+// Shipping: the central node must skip a torn last record of stock.ship and
+// never apply a record twice when it replays stock.ship after acknowledging
+// it; the store must keep shipping what a stale ack does not cover
+static void selfTestShipping() {
+    resetStore();
+    StockItem item;
+    item.productID = 1;
+    item.name = string("Shipped");
+    item.quantity = 10;
+    item.lastPrice = 200;
+    insertItem(item);
+    bool saved = saveStockSnapshot(SNAPSHOT_FILE); // The store's checkpoint, at sequence 0
+    const string restock = "1\tRESTOCK\t1\t5\n";
+    const string sale = "2\tSALE\t1\t3\t" + journalPrice(200) + '\n';
+    saved = saved && writeSelfTestFile(SHIP_FILE, restock + sale + "3\tRESTOCK\t1\t100");
+    auto replicaMatches = [](int quantity, Money revenue, long sequence) {
+        int index = findItemIndexByID(1);
+        return index >= 0 && stock[index].quantity == quantity && totalRevenue() == revenue &&
+               journalSequence == sequence;
+    };
+
+    rebaseReplica(".");
+    long applied = catchUpReplica(".");
+    selfCheck(saved && applied == 2 && replicaMatches(12, 600, 2), "torn stock.ship record is skipped, not applied");
+
+    // The central node saves the replica and acknowledges it, then replays the
+    // same stock.ship (it is only started afresh at the store's next checkpoint)
+    const string replicaPath = "replica.selftest.bin";
+    checkpointSequence = journalSequence;
+    bool replayed = saveStockSnapshot(replicaPath) && writeSelfTestFile(SHIP_ACK_FILE, "2\n");
+    resetStore();
+    replayed = replayed && loadStockSnapshot(replicaPath) && catchUpReplica(".") == 0 && replicaMatches(12, 600, 2);
+    selfCheck(replayed, "stock.ship replayed after its ack is not applied twice");
+
+    // Store side: the ack covers the previous checkpoint, so stock.ship starts
+    // afresh with the journal's complete records
+    const string restockMore = "3\tRESTOCK\t1\t4\n";
+    const string saleMore = "4\tSALE\t1\t1\t" + journalPrice(250) + '\n';
+    string shipped;
+    auto readShipped = [&shipped]() {
+        ifstream in(SHIP_FILE, ios::binary);
+        ostringstream contents;
+        contents << in.rdbuf();
+        shipped = contents.str();
+    };
+    bool restarted = writeSelfTestFile(JOURNAL_FILE, restockMore + "4\tSALE\t1") && shipJournalRecords(2);
+    readShipped();
+    restarted = restarted && shipped == restockMore;
+    // The same ack read again at the next checkpoint no longer covers it:
+    // stock.ship is appended to, so record 3 is not lost
+    bool kept = writeSelfTestFile(JOURNAL_FILE, saleMore) && shipJournalRecords(3);
+    readShipped();
+    kept = kept && shipped == restockMore + saleMore;
+    selfCheck(restarted && kept, "stock.ship restarts only once the ack covers the previous checkpoint");
+
+    resetStore();
+    bool caughtUp = loadStockSnapshot(replicaPath) && catchUpReplica(".") == 2 && replicaMatches(15, 850, 4) &&
+                    catchUpReplica(".") == 0 && replicaMatches(15, 850, 4);
+    selfCheck(caughtUp, "replica catches up with the records shipped since its ack exactly once");
+
+    for (const char* file : {SNAPSHOT_FILE, JOURNAL_FILE, SHIP_FILE, SHIP_ACK_FILE}) remove(file);
+    remove(replicaPath.c_str());
+    resetStore();
+}
+
+// Runs every check in dir, which is used as the store directory; its data
+// files are replaced
+bool runSelfTest(const string& dir) {
+    if (!enterScratchDirectory(dir)) {
+        cerr << "Could not use self test directory " << dir << endl;
+        return false;
+    }
+    startLogger();
+    selfTestFailures = 0;
+    selfTestLz4();
+    selfTestSnapshot();
+    selfTestShipping();
+    if (selfTestFailures == 0) cout << "All checks passed" << endl;
+    else cout << selfTestFailures << " check(s) failed" << endl;
+    return selfTestFailures == 0;
+}
+
+// Quotes a field for a comma separated reply when it contains a comma or quote
+string csvField(const string& value) {
+    if (value.find_first_of(",\"") == string::npos) return value;
+    string quoted = "\"";
+    for (char c : value) {
+        if (c == '"') quoted += '"';
+        quoted += c;
+    }
+    return quoted + '"';
+}
+
+// Answers one request line from a register. Replies are a single line:
+// "OK[,fields]" or "ERR,<reason>". Besides the batch commands it accepts
+//   LOOKUP,id    -> OK,id,name,category,qty,price
+//   REVENUE      -> OK,total
+//   GET /metrics -> an HTTP response with formatMetricsText() (for Prometheus)
+// SALE and RESTOCK reply with the remaining quantity.
+string handleServerRequest(const string& line, bool& closeConnection) {
+    if (line.compare(0, 4, "GET ") == 0) {
+        // HTTP scrape (GET /metrics): one response, then the connection closes
+        closeConnection = true;
+        string target = line.substr(4, line.find_first_of(" \r", 4) - 4);
+        bool metrics = target == "/metrics";
+        string body = metrics ? formatMetricsText() : "Not found\n";
+        string response = string(metrics ? "HTTP/1.0 200 OK" : "HTTP/1.0 404 Not Found") +
+                          "\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " + to_string(body.size()) +
+                          "\r\nConnection: close\r\n\r\n" + body;
+        response.pop_back(); // The server ends every reply with '\n'
+        return response;
+    }
+    vector<string> fields = splitCsvLine(line);
+    string command = commandName(fields[0]);
+    if (command.empty()) return "";
+
+    ostringstream reply;
+    if (command == "QUIT") {
+        closeConnection = true;
+        return "OK";
+    }
+    if (command == "REVENUE") {
+        reply << "OK," << formatMoney(Inventory::revenue());
+        return reply.str();
+    }
+    if (command == "LOOKUP") {
+        StockItem item;
+        int id = 0;
+        try {
+            id = fields.size() == 2 ? stoi(fields[1]) : 0;
+        } catch (...) {}
+        if (!Inventory::get(id, item)) return string("ERR,") + opResultText(OP_NOT_FOUND);
+        reply << "OK," << item.productID << ',' << csvField(item.name) << ','
+              << csvField(categoryName(item.categoryID)) << ',' << item.quantity << ','
+              << formatMoney(item.lastPrice);
+        return reply.str();
+    }
+
+    OpResult result = applyCommand(command, fields);
+    if (result != OP_OK) return string("ERR,") + opResultText(result);
+
+    StockItem item;
+    if ((command == "SALE" || command == "RESTOCK") && Inventory::get(stoi(fields[1]), item)) {
+        return "OK," + to_string(item.quantity);
+    }
+    return "OK";
+}
+
+#ifdef __linux__
+volatile sig_atomic_t serverStopping = 0;
+
+void stopServer(int) {
+    serverStopping = 1;
+}
+
+// A request line longer than this is refused and its connection closed, so one
+// client cannot fill memory with a line that never ends. Each round reads at
+// most SERVER_READ_LIMIT bytes per connection; the rest waits in the socket.
+const size_t SERVER_MAX_LINE = 8192;
+const size_t SERVER_READ_LIMIT = 1 << 20;
+
+struct ServerConnection {
+    string input;      // Bytes received but not yet a complete line
+    string output;     // Replies not yet accepted by the socket
+    bool closing = false;
+};
+
+// Writes as much pending output as the socket takes; false if the peer is gone
+bool flushConnection(int fd, ServerConnection& connection) {
+    while (!connection.output.empty()) {
+        ssize_t sent = send(fd, connection.output.data(), connection.output.size(), MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        connection.output.erase(0, (size_t)sent);
+    }
+    return true;
+}
+
+// TCP server for register clients, one epoll loop on this thread. Requests use
+// the line protocol of handleServerRequest() and may be pipelined: every complete
+// line in a read is answered in order. Journal records written while handling one
+// round of events are committed with a single fsync before any reply is sent.
+bool runServer(int port) {
+    int listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (listener < 0) {
+        cerr << "Could not create server socket" << endl;
+        return false;
+    }
+    int enable = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons((uint16_t)port);
+    if (bind(listener, (sockaddr*)&address, sizeof(address)) < 0 || listen(listener, SOMAXCONN) < 0) {
+        cerr << "Could not listen on port " << port << endl;
+        close(listener);
+        return false;
+    }
+
+    int poller = epoll_create1(0);
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = listener;
+    epoll_ctl(poller, EPOLL_CTL_ADD, listener, &event);
+
+    signal(SIGINT, stopServer);
+    signal(SIGTERM, stopServer);
+    logAction("Server listening on port " + to_string(port));
+    cout << "Listening on port " << port << " (Ctrl+C to stop)" << endl;
+
+    unordered_map<int, ServerConnection> connections;
+    const int MAX_EVENTS = 64;
+    epoll_event events[MAX_EVENTS];
+    char buffer[16384];
+
+    while (!serverStopping) {
+        int ready = epoll_wait(poller, events, MAX_EVENTS, 1000);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        beginJournalBatch(); // Group commit: one fsync for this whole round
+        vector<int> touched;
+        for (int i = 0; i < ready; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == listener) {
+                int client;
+                while ((client = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK)) >= 0) {
+                    epoll_event clientEvent = {};
+                    clientEvent.events = EPOLLIN | EPOLLRDHUP;
+                    clientEvent.data.fd = client;
+                    epoll_ctl(poller, EPOLL_CTL_ADD, client, &clientEvent);
+                    connections[client];
+                }
+                continue;
+            }
+
+            ServerConnection& connection = connections[fd];
+            if (events[i].events & EPOLLIN) {
+                ssize_t received = 1;
+                while (connection.input.size() < SERVER_READ_LIMIT &&
+                       (received = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+                    connection.input.append(buffer, (size_t)received);
+                }
+                if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                    connection.closing = true;
+                }
+
+                // Answer every complete line, in order
+                size_t start = 0, end;
+                while ((end = connection.input.find('\n', start)) != string::npos) {
+                    if (end - start > SERVER_MAX_LINE) break;
+                    bool closeRequested = false;
+                    string reply = handleServerRequest(connection.input.substr(start, end - start), closeRequested);
+                    if (!reply.empty()) connection.output += reply + '\n';
+                    start = end + 1;
+                    if (closeRequested) {
+                        // Nothing after QUIT (or an HTTP request's headers) is answered
+                        connection.closing = true;
+                        start = connection.input.size();
+                        break;
+                    }
+                }
+                connection.input.erase(0, start);
+                size_t lineLength = min(connection.input.find('\n'), connection.input.size());
+                if (!connection.closing && lineLength > SERVER_MAX_LINE) {
+                    connection.output += "ERR,request line longer than " + to_string(SERVER_MAX_LINE) + " bytes\n";
+                    connection.closing = true;
+                    connection.input.clear();
+                }
+            }
+            if (events[i].events & (EPOLLHUP | EPOLLERR)) connection.closing = true;
+            touched.push_back(fd);
+        }
+        commitJournalGroup();
+
+        // Replies go out only after the records they acknowledge are on disk
+        for (int fd : touched) {
+            auto it = connections.find(fd);
+            if (it == connections.end()) continue;
+            ServerConnection& connection = it->second;
+            bool alive = flushConnection(fd, connection);
+            if (!alive || (connection.closing && connection.output.empty())) {
+                epoll_ctl(poller, EPOLL_CTL_DEL, fd, nullptr);
+                close(fd);
+                connections.erase(it);
+                continue;
+            }
+            epoll_event clientEvent = {};
+            clientEvent.events = EPOLLIN | EPOLLRDHUP | (connection.output.empty() ? 0u : uint32_t(EPOLLOUT));
+            clientEvent.data.fd = fd;
+            epoll_ctl(poller, EPOLL_CTL_MOD, fd, &clientEvent);
         }
     }
+
+    for (auto& entry : connections) close(entry.first);
+    close(poller);
+    close(listener);
+    checkpointStock();
+    logAction("Server stopped");
+    cout << "Server stopped" << endl;
     return true;
 }
-
-// Prompts user for Y/N confirmation
-bool confirmAction(const string& message) {
-    char choice;
-    cout << message << " (Y/N): ";
-    cin >> choice;
-    return (toupper(choice) == 'Y');
+#else
+bool runServer(int port) {
+    cerr << "Server mode (port " << port << ") is only available on Linux" << endl;
+    return false;
 }
+#endif
 
-// Displays a formatted table of stock items
-void displayItemTable(const vector<StockItem>& items) {
-    if (items.empty()) {
-        cout << "No items to display." << endl;
-        return;
-    }
-    
-    cout << left << setw(8) << "ID" << setw(25) << "Product Name" << setw(15) << "Category"
-         << setw(8) << "Qty" << setw(12) << "Last Price" << setw(8) << "Status" << endl;
-    cout << string(80, '-') << endl;
+// Asks for the next item to sell until one with units left is chosen. Input is a
+// product ID (typed or scanned) or a name, looked up through the indexes; anything
+// else is searched for and only the matches are shown. Each screen shows at most
+// one page, so the cost per sale does not grow with the catalog.
+// The chosen item is copied into selected (a position or pointer would not
+// survive another thread removing items); returns false when the user
+// finishes the sale.
+bool selectSaleItem(size_t& page, size_t pages, Money sessionTotal, int salesCount,
+                    unordered_map<int, int>& inBasket, StockItem& selected) {
+    vector<StockItem> matches; // First page of the last search, shown instead of the stock page
+    size_t matchCount = 0;
+    string notice;
+    while (true) {
+        clearScreen();
+        cout << "=== MAKE A SALE ===" << endl;
+        cout << "Basket Total: $" << formatMoney(sessionTotal) 
+             << " | Lines: " << salesCount << endl;
+        cout << string(70, '-') << endl;
 
-    for (const auto& item : items) {
-        cout << left << setw(8) << item.productID 
-             << setw(25) << (item.name.length() > 23 ? item.name.substr(0, 22) + "..." : item.name)
-             << setw(15) << (item.category.length() > 13 ? item.category.substr(0, 12) + "..." : item.category)
-             << setw(8) << item.quantity
-             << setw(12) << (item.lastPrice > 0 ? "$" + to_string(item.lastPrice).substr(0, 8) : "Not Set");
-        
-        if (item.quantity == 0) cout << "OUT";
-        else if (item.quantity < 15) cout << "LOW";
-        else cout << "OK";
-        
-        cout << endl;
-    }
-    cout << string(80, '-') << endl;
-}
+        if (!matches.empty()) {
+            displayItemTable(matches);
+            if (matchCount > matches.size()) {
+                cout << (matchCount - matches.size()) << " more matches; type more of the name to narrow them down." << endl;
+            }
+        } else {
+            displayItemPage(Inventory::snapshot(), page);
+        }
+        if (!notice.empty()) cout << "\n" << notice << endl;
+        notice.clear();
 
-// Loads the grand total sales from file
-void loadGrandTotalFromFile() {
-    ifstream file("grand_total.dat");
-    if (file.is_open()) {
-        file >> grandTotalSales;
-        file.close();
-    }
-}
+        cout << "\nProduct ID or name (0 to finish";
+        if (!matches.empty()) cout << ", Enter for the full list";
+        else if (pages > 1) cout << ", N/P/G<n> to change page";
+        cout << "): ";
 
-// Saves the grand total sales to file
-void saveGrandTotalToFile() {
-    ofstream file("grand_total.dat");
-    if (file.is_open()) {
-        file << grandTotalSales;
-        file.close();
-    }
-}
+        string input;
+        if (!getline(cin, input)) return false; // End of input finishes the sale
+        size_t first = input.find_first_not_of(" \t");
+        size_t last = input.find_last_not_of(" \t\r");
+        input = first == string::npos ? "" : input.substr(first, last - first + 1);
 
-// Loads stock data from file into memory
-void loadStockFromFile() {
-    ifstream file("stock.dat");
-    if (!file.is_open()) {
-        cout << "No existing stock file found. Starting fresh." << endl;
-        pauseScreen();
-        return;
-    }
-    
-    stock.clear();
-    StockItem item;
-    while (file >> item.productID && file.ignore() &&
-           getline(file, item.name) &&
-           getline(file, item.category) &&
-           file >> item.quantity >> item.lastPrice >> item.dateAdded && file.ignore()) {
-        stock.push_back(item);
-    }
-    file.close();
-    logAction("Stock data loaded successfully (" + to_string(stock.size()) + " items)");
-}
+        if (input.empty()) {
+            matches.clear();
+            continue;
+        }
+        if (input == "0") return false;
+        if (matches.empty() && pages > 1 && readPageCommand(input, page, pages)) continue;
 
-// Saves current stock data to file
-void saveStockToFile() {
-    ofstream file("stock.dat");
-    if (!file.is_open()) {
-        cerr << "Error saving stock data!" << endl;
-        return;
-    }
-    
-    for (const auto& item : stock) {
-        file << item.productID << endl
-             << item.name << endl
-             << item.category << endl
-             << item.quantity << endl
-             << item.lastPrice << endl
-             << item.dateAdded << endl;
-    }
-    file.close();
-}
+        StockItem& item = selected;
+        bool found = false;
+        int id = 0;
+        auto parsed = from_chars(input.data(), input.data() + input.size(), id);
+        if (parsed.ec == errc() && parsed.ptr == input.data() + input.size()) {
+            found = Inventory::get(id, item);
+        }
+        if (!found) found = Inventory::getByName(input, item);
+        if (!found) {
+            vector<size_t> results;
+            StockSnapshot view = Inventory::queryView(input, results);
+            if (results.empty()) {
+                notice = "No item matches \"" + input + "\".";
+                continue;
+            }
+            if (results.size() > 1) {
+                matches.clear();
+                for (size_t i = 0; i < results.size() && i < TABLE_PAGE_ROWS; ++i) matches.push_back(view[results[i]]);
+                matchCount = results.size();
+                continue;
+            }
+            item = view[results[0]];
+        }
 
-// Logs an action to the history and memory
-void logAction(const string& action) {
-    time_t now = time(0);
-    char* dt = ctime(&now);
-    string timestamp(dt);
-    timestamp.erase(timestamp.length()-1);
-    
-    ofstream historyFile("history.log", ios::app);
-    if (historyFile.is_open()) {
-        historyFile << "[" << timestamp << "] " << action << endl;
-        historyFile.close();
+        int available = item.quantity - inBasket[item.productID];
+        if (available <= 0) {
+            notice = item.name + (item.quantity > 0 ? " is already all in the basket!" : " is out of stock!");
+            continue;
+        }
+        return true;
     }
-    
-    historyLog.push_back("[" + timestamp + "] " + action);
 }
 
-// Handles the sale of items, updates stock and sales
+// Handles the sale of items: lines are collected into a basket, which is then
+// checked out (stock, revenue, journal and history) in one step
 void makeSale() {
     clearScreen();
     cout << "=== MAKE A SALE ===" << endl;
@@ -257,45 +5539,20 @@ void makeSale() {
         return;
     }
 
-    double sessionTotal = 0.0;
+    Basket basket;
+    unordered_map<int, int> inBasket; // productID -> units already in the basket
+    Money sessionTotal = 0;
     int salesCount = 0;
+    size_t page = 0, pages = tablePageCount(stock.size());
     string again;
+    cin.ignore(numeric_limits<streamsize>::max(), '\n');
     
     do {
-        clearScreen();
-        cout << "=== MAKE A SALE ===" << endl;
-        cout << "Session Total: $" << fixed << setprecision(2) << sessionTotal 
-             << " | Sales Made: " << salesCount << endl;
-        cout << string(70, '-') << endl;
-        
-        displayItemTable(stock);
-
-        int choice = 0;
-        cout << "\nSelect item number to sell (0 to finish): ";
-        while (!(cin >> choice) || choice < 0 || choice > (int)stock.size()) {
-            cin.clear(); 
-            cin.ignore(numeric_limits<streamsize>::max(), '\n');
-            cout << "Invalid choice. Please enter 0-" << stock.size() << ": ";
-        }
-        
-        if (choice == 0) {
-            if (salesCount > 0) {
-                cout << "\nSale session completed!" << endl;
-                cout << "Items sold: " << salesCount << " | Session total: $" << sessionTotal << endl;
-            } else {
-                cout << "No sales made." << endl;
-            }
-            break;
-        }
-
-        auto& item = stock[choice - 1];
-        if (item.quantity == 0) {
-            cout << "\n" << item.name << " is out of stock!" << endl;
-            pauseScreen();
-            continue;
-        }
+        StockItem item;
+        if (!selectSaleItem(page, pages, sessionTotal, salesCount, inBasket, item)) break;
+        int available = item.quantity - inBasket[item.productID];
         
-        cout << "\nSelected: " << item.name << " (Available: " << item.quantity << ")" << endl;
+        cout << "\nSelected: " << item.name << " (Available: " << available << ")" << endl;
         
         int sellQty;
         do {
@@ -310,22 +5567,22 @@ void makeSale() {
                 cout << "Sale cancelled." << endl;
                  continue;
             }
-            if (sellQty < 0 || sellQty > item.quantity) {
-                cout << "Invalid quantity. Available: " << item.quantity << endl;
+            if (sellQty < 0 || sellQty > available) {
+                cout << "Invalid quantity. Available: " << available << endl;
                 continue;
             }
             break;
         } while (true);
         
-        double price;
+        Money price;
         do {
             cout << "Enter price per unit";
             if (item.lastPrice > 0) {
-                cout << " (last: $" << item.lastPrice << ")";
+                cout << " (last: $" << formatMoney(item.lastPrice) << ")";
             }
             cout << ": $";
             
-            if (!(cin >> price) || price < 0) {
+            if (!readMoney(cin, price) || price < 0) {
                 cin.clear(); 
                 cin.ignore(numeric_limits<streamsize>::max(), '\n');
                 cout << "Please enter a valid price." << endl;
@@ -334,22 +5591,13 @@ void makeSale() {
             break;
         } while (true);
         
-        double total = price * sellQty;
+        Money total = price * sellQty;
+        basket.push_back({item.productID, sellQty, price});
+        inBasket[item.productID] += sellQty;
         sessionTotal += total;
-        grandTotalSales += total;
-        item.quantity -= sellQty;
-        item.lastPrice = price;
         salesCount++;
         
-        saveStockToFile();
-        saveGrandTotalToFile();
-        
-        logAction("SALE: " + to_string(sellQty) + "x " + item.name + " @ $" + 
-                 to_string(price) + " each = $" + to_string(total) + 
-                 " (Remaining: " + to_string(item.quantity) + ")");
-        
-        cout << "\nSale recorded successfully!" << endl;
-        cout << "Sale amount: $" << total << " | Remaining stock: " << item.quantity << endl;
+        cout << "\nAdded to basket: " << sellQty << "x " << item.name << " = $" << formatMoney(total) << endl;
         
         continue_sales:
         cout << "\nContinue selling? (Y/N): ";
@@ -357,8 +5605,24 @@ void makeSale() {
         getline(cin, again);
         
     } while (again == "Y" || again == "y");
+
+    if (basket.empty()) {
+        cout << "No sales made." << endl;
+    } else {
+        size_t failedLine = 0;
+        OpResult result = Inventory::checkout(basket, &failedLine);
+        if (result == OP_OK) {
+            cout << "\nSale recorded successfully!" << endl;
+            cout << "Lines sold: " << salesCount << " | Sale total: $" << formatMoney(sessionTotal) << endl;
+        } else {
+            cout << "\nSale cancelled, nothing was sold: line " << (failedLine + 1) << " "
+                 << opResultText(result) << "." << endl;
+        }
+    }
     
-    pauseScreen();
+    // Input here is line based, so there is no leftover newline for pauseScreen() to skip
+    cout << "\nPress Enter to continue...";
+    cin.get();
 }
 
 // Displays the stock history log and summary
@@ -366,38 +5630,46 @@ void viewStockHistory() {
     clearScreen();
     cout << "=== STOCK HISTORY LOG ===" << endl;
 
-    ifstream historyFile("history.log");
-    if (!historyFile.is_open()) {
+    // Counters come from the history index, so this is O(1) however big the log is
+    flushLogger();
+    uint64_t totalCount, salesCount, addCount, updateCount, deleteCount, segments, archivedBytes;
+    {
+        lock_guard<mutex> lock(historyIndexMutex);
+        segments = historyIndex.nextSegment - historyIndex.firstSegment;
+        archivedBytes = historyIndex.archivedBytes;
+        totalCount = historyIndex.totalCount;
+        salesCount = historyIndex.typeCounts[ACTION_SALE];
+        addCount = historyIndex.typeCounts[ACTION_ADD] + historyIndex.typeCounts[ACTION_RESTOCK];
+        updateCount = historyIndex.typeCounts[ACTION_UPDATE];
+        deleteCount = historyIndex.typeCounts[ACTION_DELETE];
+    }
+    if (totalCount == 0) {
         cout << "No history log found." << endl;
         pauseScreen();
         return;
     }
     
-    vector<string> allLogs;
-    string line;
-    int salesCount = 0, addCount = 0, updateCount = 0, deleteCount = 0;
-    
-    while (getline(historyFile, line)) {
-        allLogs.push_back(line);
-        if (line.find("SALE:") != string::npos) salesCount++;
-        else if (line.find("Added") != string::npos || line.find("NEW ITEM") != string::npos) addCount++;
-        else if (line.find("Updated") != string::npos || line.find("UPDATE") != string::npos) updateCount++;
-        else if (line.find("Deleted") != string::npos || line.find("DELETE") != string::npos) deleteCount++;
-    }
-    historyFile.close();
-    
-    cout << "SUMMARY: " << allLogs.size() << " total actions | " 
+    cout << "SUMMARY: " << totalCount << " total actions | " 
          << salesCount << " sales | " << addCount << " additions | "
          << updateCount << " updates | " << deleteCount << " deletions" << endl;
+    if (segments > 0) {
+        cout << "ARCHIVE: " << segments << " rotated segment(s), " << (archivedBytes + 1023) / 1024
+             << " KB compressed (included in the counts above)" << endl;
+    }
     cout << string(80, '-') << endl;
     
-    // Show recent entries (last 20)
-    int startIndex = max(0, (int)allLogs.size() - 20);
-    cout << "Recent Activities (last " << (allLogs.size() - startIndex) << " entries):" << endl;
-    cout << string(80, '-') << endl;
-    
-    for (size_t i = startIndex; i < allLogs.size(); ++i) {
-        cout << allLogs[i] << endl;
+    // Show recent entries (last 20) straight from the in-memory ring
+    {
+        lock_guard<mutex> lock(historyRingMutex);
+        size_t shown = min(historyRingCount, HISTORY_RECENT_COUNT);
+        cout << "Recent Activities (last " << shown << " entries):" << endl;
+        cout << string(80, '-') << endl;
+
+        size_t first = (historyRingNext + HISTORY_RING_CAPACITY - shown) % HISTORY_RING_CAPACITY;
+        for (size_t i = 0; i < shown; ++i) {
+            const HistoryRecord& record = historyRing[(first + i) % HISTORY_RING_CAPACITY];
+            cout << "[" << formatTimestamp(record.timestamp) << "] " << record.text << '\n';
+        }
     }
     
     pauseScreen();
@@ -418,7 +5690,7 @@ void addNewItem() {
         cout << string(50, '-') << endl;
 
         StockItem newItem;
-        newItem.lastPrice = 0.0;
+        newItem.lastPrice = 0;
         newItem.dateAdded = time(0);
 
         // Product ID with validation
@@ -442,33 +5714,30 @@ void addNewItem() {
         // Item name with duplicate checking
         do {
             cout << "Enter item name: ";
-            getline(cin, newItem.name);
+            string name;
+            getline(cin, name);
+            newItem.name = name;
             if (newItem.name.empty()) {
                 cout << "Item name cannot be empty." << endl;
                 continue;
             }
 
             // Check for duplicate names
-            auto it = find_if(stock.begin(), stock.end(), [&](const StockItem& item) {
-                return item.name == newItem.name;
-            });
-
-            if (it != stock.end()) {
+            StockItem existing;
+            if (Inventory::getByName(newItem.name, existing)) {
                 cout << "Item '" << newItem.name << "' already exists!" << endl;
                 if (confirmAction("Add more quantity to existing item?")) {
                     int addQty;
-                    cout << "Current stock: " << it->quantity << endl;
+                    cout << "Current stock: " << existing.quantity << endl;
                     cout << "Enter quantity to add: ";
                     while (!(cin >> addQty) || addQty < 0) {
                         cin.clear();
                         cin.ignore(numeric_limits<streamsize>::max(), '\n');
                         cout << "Please enter a positive number: ";
                     }
-                    it->quantity += addQty;
-                    saveStockToFile();
-                    logAction("RESTOCK: Added " + to_string(addQty) + " units to " + it->name +
-                              " (New total: " + to_string(it->quantity) + ")");
-                    cout << "Stock updated! New quantity: " << it->quantity << endl;
+                    Inventory::restock(existing.productID, addQty);
+                    Inventory::get(existing.productID, existing);
+                    cout << "Stock updated! New quantity: " << existing.quantity << endl;
                     itemsAdded++;
                     goto ask_continue;
                 }
@@ -482,11 +5751,12 @@ void addNewItem() {
         for (size_t i = 0; i < categoryOptions.size(); ++i) {
             cout << "  " << (i + 1) << ". " << categoryOptions[i] << endl;
         }
+        cout << "  " << (categoryOptions.size() + 1) << ". New category..." << endl;
 
         int catChoice;
         do {
-            cout << "Enter category number (1-" << categoryOptions.size() << "): ";
-            if (!(cin >> catChoice) || catChoice < 1 || catChoice > (int)categoryOptions.size()) {
+            cout << "Enter category number (1-" << (categoryOptions.size() + 1) << "): ";
+            if (!(cin >> catChoice) || catChoice < 1 || catChoice > (int)categoryOptions.size() + 1) {
                 cin.clear();
                 cin.ignore(numeric_limits<streamsize>::max(), '\n');
                 cout << "Invalid choice." << endl;
@@ -495,12 +5765,17 @@ void addNewItem() {
             break;
         } while (true);
 
-        newItem.category = categoryOptions[catChoice - 1];
+        if (catChoice == (int)categoryOptions.size() + 1) {
+            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+            newItem.categoryID = promptNewCategory();
+        } else {
+            newItem.categoryID = (uint16_t)(catChoice - 1);
+        }
 
         // Enter initial price
         do {
             cout << "Enter initial price: $";
-            if (!(cin >> newItem.lastPrice) || newItem.lastPrice < 0) {
+            if (!readMoney(cin, newItem.lastPrice) || newItem.lastPrice < 0) {
                 cin.clear();
                 cin.ignore(numeric_limits<streamsize>::max(), '\n');
                 cout << "Please enter a valid price." << endl;
@@ -524,10 +5799,7 @@ void addNewItem() {
             break;
         } while (true);
 
-        stock.push_back(newItem);
-        saveStockToFile();
-        logAction("NEW ITEM: Added " + newItem.name + " (ID: " + to_string(newItem.productID) +
-                  ", Category: " + newItem.category + ", Qty: " + to_string(newItem.quantity) + ")");
+        Inventory::add(newItem); // ID and name were checked when they were entered
 
         cout << "Item '" << newItem.name << "' added successfully!" << endl;
         itemsAdded++;
@@ -548,31 +5820,46 @@ void viewAllItems() {
     clearScreen();
     cout << "=== ALL STOCK ITEMS ===" << endl;
 
-    if (stock.empty()) {
+    // The statistics (from the columns) and every page come from the same
+    // moment, so they agree with each other even while sales carry on
+    Inventory::StockOverview totals;
+    StockSnapshot view = Inventory::overviewView(lowStockThreshold, totals);
+    if (view.empty()) {
         cout << "No items in stock." << endl;
         pauseScreen();
         return;
     }
     
-    // Statistics
-    int totalQuantity = 0, lowStockCount = 0, outOfStockCount = 0;
-    map<string, int> categoryCount;
-    
-    for (const auto& item : stock) {
-        totalQuantity += item.quantity;
-        if (item.quantity == 0) outOfStockCount++;
-        else if (item.quantity < 15) lowStockCount++;
-        categoryCount[item.category]++;
+    ostringstream overview;
+    overview << "OVERVIEW: " << view.size() << " items | Total Qty: " << totals.totalQuantity 
+             << " | Out of Stock: " << totals.outOfStock << " | Low Stock: " << totals.low << endl;
+    overview << "CATEGORIES:";
+    for (size_t i = 0; i < totals.categoryCount.size(); ++i) {
+        if (totals.categoryCount[i] > 0) overview << " " << view.category((uint16_t)i) << " (" << totals.categoryCount[i] << ")";
+    }
+    overview << endl;
+    overview << string(80, '=') << endl;
+
+    // One page per screen; the statistics above are only computed once
+    size_t page = 0, pages = tablePageCount(view.size());
+    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    while (true) {
+        clearScreen();
+        cout << "=== ALL STOCK ITEMS ===" << endl;
+        cout << overview.str();
+        displayItemPage(view, page);
+        cout << string(80, '=') << endl;
+
+        if (pages == 1) {
+            cout << "\nPress Enter to continue...";
+            cin.get();
+            return;
+        }
+        cout << "\nN = next page, P = previous page, G<n> = go to page n, Enter = back: ";
+        string input;
+        if (!getline(cin, input) || input.empty()) return;
+        readPageCommand(input, page, pages);
     }
-    
-    cout << "OVERVIEW: " << stock.size() << " items | Total Qty: " << totalQuantity 
-         << " | Out of Stock: " << outOfStockCount << " | Low Stock: " << lowStockCount << endl;
-    cout << string(80, '=') << endl;
-    
-    displayItemTable(stock);
-    
-    cout << string(80, '=') << endl;
-    pauseScreen();
 }
 
 // Updates details of an existing item
@@ -591,157 +5878,182 @@ void updateItem() {
     cin.ignore();
     getline(cin, searchTerm);
 
-    bool found = false;
-    for (auto& item : stock) {
-        if (item.name == searchTerm) {
-            found = true;
-            cout << "\nCURRENT DETAILS:" << endl;
-            cout << "  Product ID: " << item.productID << endl;
-            cout << "  Name: " << item.name << endl;
-            cout << "  Category: " << item.category << endl;
-            cout << "  Quantity: " << item.quantity << endl;
-            cout << "  Last Price: $" << item.lastPrice << endl;
-            
-            cout << "\nWhat would you like to update?" << endl;
-            cout << "1. Product ID" << endl;
-            cout << "2. Name" << endl;
-            cout << "3. Category" << endl;
-            cout << "4. Quantity" << endl;
-            cout << "5. Last Price" << endl;
-            cout << "6. All fields" << endl;
-            cout << "Choice: ";
-            
-            int updateChoice;
-            while (!(cin >> updateChoice) || updateChoice < 1 || updateChoice > 5) {
-                cin.clear();
-                cin.ignore(numeric_limits<streamsize>::max(), '\n');
-                cout << "Invalid choice (1-5): ";
-            }
-            cin.ignore();
-            
-            string oldValues = item.name + " (ID:" + to_string(item.productID) + ")";
-            
-            switch (updateChoice) {
-                case 1: {
-                    int newID;
-                    do {
-                        cout << "New Product ID: ";
-                        if (!(cin >> newID)) {
-                            cin.clear();
-                            cin.ignore(numeric_limits<streamsize>::max(), '\n');
-                            cout << "Invalid input." << endl;
-                            continue;
-                        }
-                        if (!isValidProductID(newID, &item - &stock[0])) {
-                            cout << "ID must be positive and unique." << endl;
-                            continue;
-                        }
-                        item.productID = newID;
-                        break;
-                    } while (true);
-                    break;
-                }
-                case 2: {
-                    cout << "New name: ";
-                    getline(cin, item.name);
-                    break;
-                }
-                case 3: {
-                    cout << "Choose new category:" << endl;
-                    for (size_t i = 0; i < categoryOptions.size(); ++i) {
-                        cout << i + 1 << ". " << categoryOptions[i] << endl;
+    int index = findItemIndexByName(searchTerm);
+    bool found = index >= 0;
+    if (found) {
+        StockItem item = stock[index]; // Edited copy, applied in one step below
+        cout << "\nCURRENT DETAILS:" << endl;
+        cout << "  Product ID: " << item.productID << endl;
+        cout << "  Name: " << item.name << endl;
+        cout << "  Category: " << categoryName(item.categoryID) << endl;
+        cout << "  Quantity: " << item.quantity << endl;
+        cout << "  Last Price: $" << formatMoney(item.lastPrice) << endl;
+        
+        cout << "\nWhat would you like to update?" << endl;
+        cout << "1. Product ID" << endl;
+        cout << "2. Name" << endl;
+        cout << "3. Category" << endl;
+        cout << "4. Quantity" << endl;
+        cout << "5. Last Price" << endl;
+        cout << "6. All fields" << endl;
+        cout << "Choice: ";
+        
+        int updateChoice;
+        while (!(cin >> updateChoice) || updateChoice < 1 || updateChoice > 5) {
+            cin.clear();
+            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+            cout << "Invalid choice (1-5): ";
+        }
+        cin.ignore();
+        
+        int oldID = item.productID;
+        
+        switch (updateChoice) {
+            case 1: {
+                int newID;
+                do {
+                    cout << "New Product ID: ";
+                    if (!(cin >> newID)) {
+                        cin.clear();
+                        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                        cout << "Invalid input." << endl;
+                        continue;
                     }
-                    int catChoice;
-                    cout << "Category number: ";
-                    if (cin >> catChoice && catChoice >= 1 && catChoice <= (int)categoryOptions.size()) {
-                        item.category = categoryOptions[catChoice - 1];
+                    if (!isValidProductID(newID, index)) {
+                        cout << "ID must be positive and unique." << endl;
+                        continue;
                     }
-                    cin.ignore();
+                    item.productID = newID;
                     break;
+                } while (true);
+                break;
+            }
+            case 2: {
+                string newName;
+                cout << "New name: ";
+                getline(cin, newName);
+                int existing = findItemIndexByName(newName);
+                if (existing >= 0 && existing != index) {
+                    cout << "Item '" << newName << "' already exists. Keeping current name." << endl;
+                } else {
+                    item.name = newName;
                 }
-                case 4: {
-                    cout << "New quantity: ";
-                    int newQty;
-                    if (cin >> newQty && newQty >= 0) {
-                        item.quantity = newQty;
-                    }
+                break;
+            }
+            case 3: {
+                cout << "Choose new category:" << endl;
+                for (size_t i = 0; i < categoryOptions.size(); ++i) {
+                    cout << i + 1 << ". " << categoryOptions[i] << endl;
+                }
+                cout << categoryOptions.size() + 1 << ". New category..." << endl;
+                int catChoice = 0;
+                cout << "Category number: ";
+                if (cin >> catChoice && catChoice >= 1 && catChoice <= (int)categoryOptions.size()) {
+                    item.categoryID = (uint16_t)(catChoice - 1);
+                    cin.ignore();
+                } else if (catChoice == (int)categoryOptions.size() + 1) {
+                    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                    item.categoryID = promptNewCategory();
+                } else {
+                    cin.clear();
                     cin.ignore();
-                    break;
                 }
-                   case 5: {
-                    string input;
-                    cout << "Last Price [$" << item.lastPrice << "]: ";
-                    getline(cin, input);
-                    if (!input.empty()) {
-                        try {
-                            item.lastPrice = stod(input);
-                        } catch (...) {
-                            cout << "Invalid price. Keeping current value." << endl;
-                        }
+                break;
+            }
+            case 4: {
+                cout << "New quantity: ";
+                int newQty;
+                if (cin >> newQty && newQty >= 0) {
+                    item.quantity = newQty;
+                }
+                cin.ignore();
+                break;
+            }
+               case 5: {
+                string input;
+                cout << "Last Price [$" << formatMoney(item.lastPrice) << "]: ";
+                getline(cin, input);
+                if (!input.empty()) {
+                    try {
+                        item.lastPrice = toMoney(input);
+                    } catch (...) {
+                        cout << "Invalid price. Keeping current value." << endl;
                     }
-                    break;
                 }
+                break;
+            }
 
-                case 6: {
-                    cout << "Enter new details (leave blank to keep current):" << endl;
-                    
-                    string input;
-                    cout << "Product ID [" << item.productID << "]: ";
-                    getline(cin, input);
-                    if (!input.empty()) {
-                        try {
-                            int newID = stoi(input);
-                            if (isValidProductID(newID, &item - &stock[0])) {
-                                item.productID = newID;
-                            }
-                        } catch (...) {
-                            cout << "Invalid Product ID. Keeping current value." << endl;
+            case 6: {
+                cout << "Enter new details (leave blank to keep current):" << endl;
+                
+                string input;
+                cout << "Product ID [" << item.productID << "]: ";
+                getline(cin, input);
+                if (!input.empty()) {
+                    try {
+                        int newID = stoi(input);
+                        if (isValidProductID(newID, index)) {
+                            item.productID = newID;
                         }
+                    } catch (...) {
+                        cout << "Invalid Product ID. Keeping current value." << endl;
                     }
+                }
 
-                    cout << "Name [" << item.name << "]: ";
-                    getline(cin, input);
-                    if (!input.empty()) item.name = input;
-
-                    cout << "Choose new category (or press Enter to keep current: " << item.category << "):" << endl;
-                    for (size_t i = 0; i < categoryOptions.size(); ++i)
-                        cout << i + 1 << ". " << categoryOptions[i] << endl;
-                    getline(cin, input);
-                    if (!input.empty()) {
-                        try {
-                            int catChoice = stoi(input);
-                            if (catChoice >= 1 && catChoice <= (int)categoryOptions.size())
-                                item.category = categoryOptions[catChoice - 1];
-                        } catch (...) {}
+                cout << "Name [" << item.name << "]: ";
+                getline(cin, input);
+                if (!input.empty()) {
+                    int existing = findItemIndexByName(input);
+                    if (existing >= 0 && existing != index) {
+                        cout << "Item '" << input << "' already exists. Keeping current name." << endl;
+                    } else {
+                        item.name = input;
                     }
+                }
 
-                    cout << "Quantity [" << item.quantity << "]: ";
-                    getline(cin, input);
-                    if (!input.empty()) {
-                        try {
-                            item.quantity = stoi(input);
-                        } catch (...) {
-                            cout << "Invalid quantity. Keeping current value." << endl;
-                        }
+                cout << "Choose new category (or press Enter to keep current: " << categoryName(item.categoryID) << "):" << endl;
+                for (size_t i = 0; i < categoryOptions.size(); ++i)
+                    cout << i + 1 << ". " << categoryOptions[i] << endl;
+                cout << categoryOptions.size() + 1 << ". New category..." << endl;
+                getline(cin, input);
+                if (!input.empty()) {
+                    try {
+                        int catChoice = stoi(input);
+                        if (catChoice >= 1 && catChoice <= (int)categoryOptions.size())
+                            item.categoryID = (uint16_t)(catChoice - 1);
+                        else if (catChoice == (int)categoryOptions.size() + 1)
+                            item.categoryID = promptNewCategory();
+                    } catch (...) {}
+                }
+
+                cout << "Quantity [" << item.quantity << "]: ";
+                getline(cin, input);
+                if (!input.empty()) {
+                    try {
+                        item.quantity = stoi(input);
+                    } catch (...) {
+                        cout << "Invalid quantity. Keeping current value." << endl;
                     }
+                }
 
-                    cout << "Last Price [$" << item.lastPrice << "]: ";
-                    getline(cin, input);
-                    if (!input.empty()) {
-                        try {
-                            item.lastPrice = stod(input);
-                        } catch (...) {
-                            cout << "Invalid price. Keeping current value." << endl;
-                        }
+                cout << "Last Price [$" << formatMoney(item.lastPrice) << "]: ";
+                getline(cin, input);
+                if (!input.empty()) {
+                    try {
+                        item.lastPrice = toMoney(input);
+                    } catch (...) {
+                        cout << "Invalid price. Keeping current value." << endl;
                     }
-                    break;
                 }
+                break;
             }
+        }
 
-            saveStockToFile();
-            logAction("UPDATE: " + oldValues + " -> Updated successfully");
+        OpResult result = Inventory::update(oldID, item);
+        if (result == OP_OK) {
             cout << "Item updated successfully!" << endl;
-            break;
+        } else {
+            cout << "Item not updated: " << opResultText(result) << "." << endl;
         }
     }
 
@@ -768,23 +6080,16 @@ void deleteItem() {
     cin.ignore();
     getline(cin, searchTerm);
 
-    auto it = stock.begin();
-    bool found = false;
+    int index = findItemIndexByName(searchTerm);
+    bool found = index >= 0;
     StockItem itemToDelete;
-
-    for (; it != stock.end(); ++it) {
-        if (it->name == searchTerm) {
-            found = true;
-            itemToDelete = *it;
-            break;
-        }
-    }
+    if (found) itemToDelete = stock[index];
 
     if (found) {
         cout << "\nITEM TO DELETE:" << endl;
         cout << "  Name: " << itemToDelete.name << endl;
         cout << "  ID: " << itemToDelete.productID << endl;
-        cout << "  Category: " << itemToDelete.category << endl;
+        cout << "  Category: " << categoryName(itemToDelete.categoryID) << endl;
         cout << "  Quantity: " << itemToDelete.quantity << endl;
         
         if (itemToDelete.quantity > 0) {
@@ -792,10 +6097,7 @@ void deleteItem() {
         }
         
         if (confirmAction("\nAre you sure you want to delete this item?")) {
-            stock.erase(it);
-            saveStockToFile();
-            logAction("DELETE: Removed " + itemToDelete.name + " (ID: " + to_string(itemToDelete.productID) + 
-                     ", Had " + to_string(itemToDelete.quantity) + " units)");
+            Inventory::remove(itemToDelete.productID);
             cout << "Item '" << itemToDelete.name << "' deleted successfully!" << endl;
         } else {
             cout << "Deletion cancelled." << endl;
@@ -827,21 +6129,11 @@ void searchItem() {
         getline(cin, searchTerm);
         
         // Convert to lowercase for case-insensitive search
-        transform(searchTerm.begin(), searchTerm.end(), searchTerm.begin(), ::tolower);
+        searchTerm = normalizeSearchText(searchTerm);
 
-        vector<StockItem> results;
-        
-        for (const auto& item : stock) {
-            string itemName = item.name;
-            string itemCategory = item.category;
-            transform(itemName.begin(), itemName.end(), itemName.begin(), ::tolower);
-            transform(itemCategory.begin(), itemCategory.end(), itemCategory.begin(), ::tolower);
-            
-            if (itemName.find(searchTerm) != string::npos || 
-                itemCategory.find(searchTerm) != string::npos) {
-                results.push_back(item);
-            }
-        }
+        // Positions into a snapshot taken with the search, so hits are never copied
+        vector<size_t> results;
+        StockSnapshot view = Inventory::queryView(searchTerm, results);
 
         cout << "\nSEARCH RESULTS for '" << searchTerm << "':" << endl;
         
@@ -850,7 +6142,7 @@ void searchItem() {
         } else {
             cout << "Found " << results.size() << " item(s)" << endl;
             cout << string(70, '-') << endl;
-            displayItemTable(results);
+            displayItemTable(view, results);
         }
 
         cout << "\nSearch for another item? (Y/N): ";
@@ -861,12 +6153,170 @@ void searchItem() {
     pauseScreen();
 }
 
+// Shows the counters and latency histograms collected since the program started
+void viewStatistics() {
+    clearScreen();
+    cout << "=== STATISTICS ===" << endl;
+    cout << left << setw(14) << "Operation" << right << setw(10) << "Calls" << setw(12) << "Avg us"
+         << setw(12) << "p50 us" << setw(12) << "p99 us" << setw(14) << "Total ms" << endl;
+    cout << string(74, '-') << endl;
+    for (int id = 0; id < METRIC_COUNT; ++id) {
+        const LatencyMetric& metric = latencyMetrics[id];
+        uint64_t count = metric.count.load(memory_order_relaxed);
+        uint64_t nanos = metric.totalNanos.load(memory_order_relaxed);
+        cout << left << setw(14) << METRIC_NAMES[id] << right << setw(10) << count
+             << setw(12) << (count ? nanos / count / 1000 : 0)
+             << setw(12) << metricPercentileMicros((MetricID)id, 0.50)
+             << setw(12) << metricPercentileMicros((MetricID)id, 0.99)
+             << setw(14) << nanos / 1000000 << endl;
+    }
+    cout << string(74, '-') << endl;
+    for (int id = 0; id < COUNTER_COUNT; ++id) {
+        cout << left << setw(24) << COUNTER_NAMES[id] << counters[id].load(memory_order_relaxed) << endl;
+    }
+    cout << "\nPercentiles are histogram bucket bounds (powers of two)." << endl;
+    pauseScreen();
+}
+
+// Formats the start of a rollup bucket: "Mon 05 Oct 2026" for days, "14:00" for hours
+static string formatBucketTime(int64_t start, RollupPeriod period) {
+    time_t when = (time_t)start;
+    struct tm local;
+    #ifdef _WIN32
+        localtime_s(&local, &when);
+    #else
+        localtime_r(&when, &local);
+    #endif
+    char buffer[32];
+    strftime(buffer, sizeof(buffer), period == ROLLUP_DAILY ? "%a %d %b %Y" : "%H:00", &local);
+    return buffer;
+}
+
+// One row per bucket in [from, to] plus a total (caller holds salesLedgerMutex)
+static void reportBuckets(ostream& out, RollupPeriod period, int64_t from, int64_t to) {
+    const map<int64_t, SalesBucket>& buckets = salesRollups[period];
+    out << left << setw(18) << (period == ROLLUP_DAILY ? "Day" : "Hour") << right << setw(10) << "Lines"
+        << setw(12) << "Units" << setw(16) << "Revenue" << endl;
+    out << string(56, '-') << endl;
+    SalesTotals sum = {0, 0, 0};
+    for (auto it = buckets.lower_bound(from); it != buckets.end() && it->first <= to; ++it) {
+        const SalesTotals& totals = it->second.total;
+        out << left << setw(18) << formatBucketTime(it->first, period) << right << setw(10) << totals.lines
+            << setw(12) << totals.units << setw(16) << ("$" + formatMoney(totals.revenue)) << endl;
+        sum.lines += totals.lines;
+        sum.units += totals.units;
+        sum.revenue += totals.revenue;
+    }
+    out << string(56, '-') << endl;
+    out << left << setw(18) << "Total" << right << setw(10) << sum.lines << setw(12) << sum.units
+        << setw(16) << ("$" + formatMoney(sum.revenue)) << endl;
+}
+
+// Sorts a bucket's entries by revenue, highest first
+template <typename Key>
+static vector<pair<Key, SalesTotals>> byRevenue(const unordered_map<Key, SalesTotals>& entries) {
+    vector<pair<Key, SalesTotals>> sorted(entries.begin(), entries.end());
+    sort(sorted.begin(), sorted.end(), [](const pair<Key, SalesTotals>& a, const pair<Key, SalesTotals>& b) {
+        return a.second.revenue > b.second.revenue;
+    });
+    return sorted;
+}
+
+// Per-category revenue for each day in [from, to] (caller holds salesLedgerMutex)
+static void reportCategories(ostream& out, int64_t from, int64_t to) {
+    const map<int64_t, SalesBucket>& buckets = salesRollups[ROLLUP_DAILY];
+    bool any = false;
+    for (auto it = buckets.lower_bound(from); it != buckets.end() && it->first <= to; ++it) {
+        any = true;
+        out << formatBucketTime(it->first, ROLLUP_DAILY) << " - $" << formatMoney(it->second.total.revenue) << endl;
+        for (const auto& entry : byRevenue(it->second.categories)) {
+            out << "  " << left << setw(20) << entry.first << right << setw(12) << entry.second.units << " units"
+                << setw(16) << ("$" + formatMoney(entry.second.revenue)) << endl;
+        }
+    }
+    if (!any) out << "No sales in this period." << endl;
+}
+
+// The ten best selling products of one day (caller holds salesLedgerMutex)
+static void reportTopProducts(ostream& out, int64_t day) {
+    out << "Top products for " << formatBucketTime(day, ROLLUP_DAILY) << ":" << endl;
+    const map<int64_t, SalesBucket>& buckets = salesRollups[ROLLUP_DAILY];
+    auto found = buckets.find(day);
+    if (found == buckets.end()) {
+        out << "No sales on this day." << endl;
+        return;
+    }
+    out << left << setw(8) << "ID" << setw(25) << "Product Name" << right << setw(10) << "Units"
+        << setw(16) << "Revenue" << endl;
+    out << string(59, '-') << endl;
+    vector<pair<int, SalesTotals>> products = byRevenue(found->second.products);
+    for (size_t i = 0; i < products.size() && i < 10; ++i) {
+        int index = findItemIndexByID(products[i].first);
+        string name = index >= 0 ? stock[index].name : "(deleted)";
+        out << left << setw(8) << products[i].first
+            << setw(25) << (name.length() > 23 ? name.substr(0, 22) + "..." : name)
+            << right << setw(10) << products[i].second.units
+            << setw(16) << ("$" + formatMoney(products[i].second.revenue)) << endl;
+    }
+}
+
+// Sales reports straight from the hourly/daily rollups: each view costs
+// O(buckets shown), however many sales have been recorded
+void viewSalesReports() {
+    while (true) {
+        clearScreen();
+        cout << "=== SALES REPORTS ===" << endl;
+        cout << "1. Revenue per day (last 14 days)" << endl;
+        cout << "2. Revenue per hour (today)" << endl;
+        cout << "3. Revenue per category per day (last 7 days)" << endl;
+        cout << "4. Top products of a day" << endl;
+        cout << "5. Back" << endl;
+        cout << "Enter your choice: ";
+
+        int choice;
+        while (!(cin >> choice) || choice < 1 || choice > 5) {
+            cin.clear();
+            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+            cout << "Please enter a number between 1-5: ";
+        }
+        if (choice == 5) return;
+
+        int daysAgo = 0;
+        if (choice == 4) {
+            cout << "Days ago (0 = today): ";
+            while (!(cin >> daysAgo) || daysAgo < 0) {
+                cin.clear();
+                cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                cout << "Please enter 0 or a positive number: ";
+            }
+        }
+
+        ostringstream report;
+        {
+            lock_guard<mutex> lock(salesLedgerMutex);
+            mergePendingSales();
+            time_t now = time(0);
+            int64_t today = rollupBucketStart(now, ROLLUP_DAILY);
+            switch (choice) {
+                case 1: reportBuckets(report, ROLLUP_DAILY, rollupBucketStart(now - 13 * 86400, ROLLUP_DAILY), today); break;
+                case 2: reportBuckets(report, ROLLUP_HOURLY, today, (int64_t)now); break;
+                case 3: reportCategories(report, rollupBucketStart(now - 6 * 86400, ROLLUP_DAILY), today); break;
+                case 4: reportTopProducts(report, rollupBucketStart(now - (time_t)daysAgo * 86400, ROLLUP_DAILY)); break;
+            }
+        }
+        clearScreen();
+        cout << "=== SALES REPORTS ===" << endl;
+        cout << report.str();
+        pauseScreen();
+    }
+}
+
 // Alerts for items with low or zero stock
 void lowStockAlert() {
     clearScreen();
     cout << "=== LOW STOCK ALERT ===" << endl;
     
-    int threshold = 15;
+    int threshold = lowStockThreshold;
     cout << "Current threshold: " << threshold << " units" << endl;
     
     if (confirmAction("Change threshold?")) {
@@ -876,31 +6326,26 @@ void lowStockAlert() {
             cin.ignore(numeric_limits<streamsize>::max(), '\n');
             cout << "Please enter a positive number: ";
         }
+        lowStockThreshold = threshold; // Also used for the LOW status and sale alerts
     }
     
     cout << "\nITEMS WITH STOCK BELOW " << threshold << " UNITS:" << endl;
 
-    vector<StockItem> lowStockItems;
-    vector<StockItem> outOfStockItems;
-    
-    for (const auto& item : stock) {
-        if (item.quantity == 0) {
-            outOfStockItems.push_back(item);
-        } else if (item.quantity < threshold) {
-            lowStockItems.push_back(item);
-        }
-    }
+    // Both lists come straight off the quantity index: O(k) for k results. They
+    // are taken together with a snapshot that the tables are then drawn from.
+    vector<size_t> outOfStockItems, lowStockItems;
+    StockSnapshot view = Inventory::lowStockView(threshold, outOfStockItems, lowStockItems);
     
     if (!outOfStockItems.empty()) {
         cout << "\nCRITICAL - OUT OF STOCK (" << outOfStockItems.size() << " items):" << endl;
         cout << string(65, '-') << endl;
-        displayItemTable(outOfStockItems);
+        displayItemTable(view, outOfStockItems);
     }
     
     if (!lowStockItems.empty()) {
         cout << "\nLOW STOCK (" << lowStockItems.size() << " items):" << endl;
         cout << string(70, '-') << endl;
-        displayItemTable(lowStockItems);
+        displayItemTable(view, lowStockItems);
     }
     
     if (lowStockItems.empty() && outOfStockItems.empty()) {
@@ -912,5 +6357,25 @@ void lowStockAlert() {
         cout << "Action needed for: " << (lowStockItems.size() + outOfStockItems.size()) << " items" << endl;
     }
 
+    // Forecast from each item's recent sales rate: soonest to run out first
+    vector<ReorderLine> reorderLines = Inventory::reorder(REORDER_LEAD_DAYS);
+    cout << "\nREORDER FORECAST - expected to run out within " << REORDER_LEAD_DAYS << " days:" << endl;
+    if (reorderLines.empty()) {
+        cout << "Nothing is selling fast enough to run out that soon." << endl;
+    } else {
+        cout << left << setw(8) << "ID" << setw(25) << "Name" << right << setw(8) << "Qty"
+             << setw(12) << "Per day" << setw(12) << "Days left" << setw(10) << "Order" << endl;
+        cout << string(75, '-') << endl;
+        for (const ReorderLine& line : reorderLines) {
+            string name = line.name.size() > 24 ? line.name.substr(0, 21) + "..." : line.name;
+            char perDay[32], daysLeft[32];
+            snprintf(perDay, sizeof(perDay), "%.1f", line.perDay);
+            snprintf(daysLeft, sizeof(daysLeft), "%.1f", line.daysLeft);
+            cout << left << setw(8) << line.productID << setw(25) << name << right << setw(8) << line.quantity
+                 << setw(12) << perDay << setw(12) << daysLeft << setw(10) << line.suggested << endl;
+        }
+        cout << "Order quantities cover " << REORDER_COVER_DAYS << " days of sales at the current rate." << endl;
+    }
+
     pauseScreen();
 }
\ No newline at end of file